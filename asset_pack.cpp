@@ -0,0 +1,94 @@
+#include "asset_pack.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace Blit
+{
+   const char AssetPack::magic[8] = { 'D', 'I', 'N', 'O', 'P', 'A', 'C', 'K' };
+
+   bool AssetPack::open(const string& path, const string& basedir)
+   {
+      close();
+
+      auto mapped = MappedFile::open(path);
+      if (!mapped || mapped->size() < sizeof(Header))
+         return false;
+
+      auto hdr = reinterpret_cast<const Header*>(mapped->data());
+      if (memcmp(hdr->magic, magic, sizeof(magic)) || hdr->version != version)
+         return false;
+
+      size_t table_end = sizeof(Header) + size_t(hdr->num_entries) * sizeof(Entry);
+      if (table_end > mapped->size() ||
+            hdr->strings_offset < table_end ||
+            size_t(hdr->strings_offset) + hdr->strings_size > mapped->size() ||
+            !hdr->strings_size ||
+            mapped->data()[hdr->strings_offset + hdr->strings_size - 1] != '\0')
+         return false;
+
+      // Validate everything up front so lookups can trust the index.
+      auto table = reinterpret_cast<const Entry*>(mapped->data() + sizeof(Header));
+      for (unsigned i = 0; i < hdr->num_entries; i++)
+      {
+         auto& entry = table[i];
+         if (entry.name_offset >= hdr->strings_size ||
+               entry.offset % alignment ||
+               entry.offset > mapped->size() ||
+               entry.size > mapped->size() - entry.offset)
+            return false;
+      }
+
+      file = mapped;
+      this->basedir = basedir + "/";
+      return true;
+   }
+
+   void AssetPack::close()
+   {
+      file.reset();
+      basedir.clear();
+   }
+
+   const AssetPack::Header* AssetPack::header() const
+   {
+      return reinterpret_cast<const Header*>(file->data());
+   }
+
+   const AssetPack::Entry* AssetPack::entries() const
+   {
+      return reinterpret_cast<const Entry*>(file->data() + sizeof(Header));
+   }
+
+   const char* AssetPack::strings() const
+   {
+      return reinterpret_cast<const char*>(file->data() + header()->strings_offset);
+   }
+
+   bool AssetPack::find(const string& path, Type type, Blob& blob) const
+   {
+      if (!file || path.compare(0, basedir.size(), basedir))
+         return false;
+
+      const char *name = path.c_str() + basedir.size();
+      const char *str  = strings();
+
+      auto first = entries();
+      auto last  = first + header()->num_entries;
+      auto itr = lower_bound(first, last, name, [str](const Entry& entry, const char *name) {
+               return strcmp(str + entry.name_offset, name) < 0;
+            });
+
+      if (itr == last || strcmp(str + itr->name_offset, name) || itr->type != static_cast<uint32_t>(type))
+         return false;
+
+      blob.data   = file->data() + itr->offset;
+      blob.size   = itr->size;
+      blob.width  = itr->width;
+      blob.height = itr->height;
+      blob.owner  = file;
+      return true;
+   }
+}
+
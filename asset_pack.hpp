@@ -0,0 +1,81 @@
+#ifndef ASSET_PACK_HPP__
+#define ASSET_PACK_HPP__
+
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace Blit
+{
+   // A single archive of pre-decoded assets, built offline by tools/dinopack.
+   // The pack is mapped once and assets are used directly from the mapping,
+   // so loaders can point into it without decoding or copying anything.
+   //
+   // Layout: Header, Entry table (sorted by name), string table, then blobs.
+   // Every blob starts on an AssetPack::alignment boundary.
+   class AssetPack
+   {
+      public:
+         enum class Type : std::uint32_t
+         {
+            Image = 1, // Pixel data, width * height Blit::Pixel.
+            PCM   = 2, // Interleaved stereo float samples, as Audio::WAVFile::load_wave.
+            Level = 3, // Compiled TilemapData, stored under the name of its TMX.
+            IndexedImage = 4 // Palette, then width * height palette indices.
+         };
+
+         struct Header
+         {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t num_entries;
+            std::uint32_t strings_offset;
+            std::uint32_t strings_size;
+         };
+
+         struct Entry
+         {
+            std::uint32_t name_offset;
+            std::uint32_t type;
+            std::uint32_t width;
+            std::uint32_t height;
+            std::uint64_t offset;
+            std::uint64_t size;
+         };
+
+         struct Blob
+         {
+            const void* data;
+            std::size_t size;
+            unsigned width, height;
+            std::shared_ptr<const void> owner;
+         };
+
+         static const char magic[8];
+         static const std::uint32_t version = 1;
+         static const std::size_t alignment = 64;
+
+         bool open(const std::string& path, const std::string& basedir);
+         void close();
+         bool is_open() const { return static_cast<bool>(file); }
+
+         // Looks up an asset by the same path the loose-file loaders would open.
+         bool find(const std::string& path, Type type, Blob& blob) const;
+
+      private:
+         std::shared_ptr<const MappedFile> file;
+         std::string basedir;
+
+         const Header* header() const;
+         const Entry* entries() const;
+         const char* strings() const;
+   };
+
+   AssetPack& get_asset_pack();
+}
+
+#endif
+
@@ -0,0 +1,120 @@
+#include "atlas.hpp"
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+namespace Blit
+{
+   // Page rows start on a cache line.
+   static const size_t page_alignment = 64;
+
+   shared_ptr<const Surface::Data> Atlas::find(const string& path) const
+   {
+      lock_guard<mutex> guard{lock};
+      auto itr = images.find(path);
+      return itr != end(images) ? itr->second : nullptr;
+   }
+
+   shared_ptr<const Surface::Data> Atlas::insert(const string& path, const Surface::Data& image)
+   {
+      lock_guard<mutex> guard{lock};
+
+      // Another thread may have packed it since we looked.
+      auto existing = images.find(path);
+      if (existing != end(images))
+         return existing->second;
+
+      // Larger images are mostly backgrounds, which only waste page space.
+      if (image.w > page_width || image.h > page_height || image.w * image.h > page_width * page_height / 8)
+         return {};
+
+      bool indexed = image.indices;
+
+      Pos pos;
+      auto itr = find_if(begin(pages), end(pages), [&](Page& page) {
+               return bool(page.indices) == indexed && allocate(page, image.w, image.h, pos);
+            });
+
+      if (itr == end(pages))
+      {
+         new_page(indexed);
+         itr = end(pages) - 1;
+         if (!allocate(*itr, image.w, image.h, pos))
+            return {};
+      }
+
+      auto& page = *itr;
+
+      for (int y = 0; y < image.h; y++)
+      {
+         int src = y * image.stride;
+         int dst = (pos.y + y) * page_width + pos.x;
+         if (indexed)
+            copy(image.indices + src, image.indices + src + image.w, page.indices + dst);
+         else
+            copy(image.pixels + src, image.pixels + src + image.w, page.pixels + dst);
+      }
+
+      auto view = make_shared<Surface::Data>(page.data, Rect{pos, image.w, image.h});
+      view->palette = image.palette;
+      images[path] = view;
+      return view;
+   }
+
+   bool Atlas::allocate(Page& page, int w, int h, Pos& pos)
+   {
+      Shelf* best = nullptr;
+      for (auto& shelf : page.shelves)
+      {
+         if (shelf.h >= h && shelf.x + w <= page_width && (!best || shelf.h < best->h))
+            best = &shelf;
+      }
+
+      if (!best)
+      {
+         if (page.used_height + h > page_height)
+            return false;
+
+         page.shelves.push_back({page.used_height, h, 0});
+         page.used_height += h;
+         best = &page.shelves.back();
+      }
+
+      pos = {best->x, best->y};
+      best->x += w;
+      return true;
+   }
+
+   void Atlas::new_page(bool indexed)
+   {
+      size_t size = page_width * page_height * (indexed ? sizeof(uint8_t) : sizeof(Pixel));
+      auto buffer = make_shared<vector<uint8_t>>(size + page_alignment);
+
+      void* ptr = buffer->data();
+      size_t space = buffer->size();
+      align(page_alignment, size, ptr, space);
+
+      Page page{};
+      if (indexed)
+      {
+         page.indices = static_cast<uint8_t*>(ptr);
+         page.data    = make_shared<Surface::Data>(page.indices, nullptr, page_width, page_height, buffer);
+      }
+      else
+      {
+         page.pixels  = static_cast<Pixel*>(ptr);
+         page.data    = make_shared<Surface::Data>(page.pixels, page_width, page_height, buffer);
+      }
+
+      pages.push_back(move(page));
+   }
+
+   void Atlas::clear()
+   {
+      lock_guard<mutex> guard{lock};
+      pages.clear();
+      images.clear();
+   }
+}
+
@@ -0,0 +1,68 @@
+#ifndef ATLAS_HPP__
+#define ATLAS_HPP__
+
+#include "surface.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Blit
+{
+   // Packs small images loaded through SurfaceCache into a few large pages,
+   // so tiles, glyphs and sprite faces drawn in a frame sit close together.
+   // Images are handed out as views into their page, and are kept by path
+   // so that reloading a level finds them again instead of packing them twice.
+   //
+   // Indexed and direct color images go to separate pages. An indexed page
+   // only holds indices, each view brings the palette of its image.
+   //
+   // Pages are filled with a shelf packer: an image goes on the lowest shelf
+   // it fits on, otherwise it opens a new shelf below the last one.
+   //
+   // Levels may load on a worker thread, so every call takes a lock.
+   class Atlas
+   {
+      public:
+         static const int page_width  = 256;
+         static const int page_height = 1024;
+
+         std::shared_ptr<const Surface::Data> find(const std::string& path) const;
+
+         // Copies image into a page. Returns nullptr if it is too large for the atlas.
+         std::shared_ptr<const Surface::Data> insert(const std::string& path, const Surface::Data& image);
+
+         void clear();
+
+      private:
+         struct Shelf
+         {
+            int y, h;
+            int x;
+         };
+
+         struct Page
+         {
+            std::shared_ptr<const Surface::Data> data;
+            Pixel* pixels;
+            std::uint8_t* indices;
+            std::vector<Shelf> shelves;
+            int used_height;
+         };
+
+         std::vector<Page> pages;
+         std::map<std::string, std::shared_ptr<const Surface::Data>> images;
+         mutable std::mutex lock;
+
+         static bool allocate(Page& page, int w, int h, Pos& pos);
+         void new_page(bool indexed);
+   };
+
+   Atlas& get_atlas();
+}
+
+#endif
+
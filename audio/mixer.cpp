@@ -65,23 +65,27 @@ namespace Audio
    }
 
    PCMStream::PCMStream(shared_ptr<vector<float>> data)
-      : data(data), ptr(0)
+      : owner(data), data(data->data()), samples(data->size()), ptr(0)
+   {}
+
+   PCMStream::PCMStream(const float* data, size_t samples, shared_ptr<const void> owner)
+      : owner(move(owner)), data(data), samples(samples), ptr(0)
    {}
 
    size_t PCMStream::render(float* buffer, size_t frames)
    {
-      size_t to_write = min(frames * Mixer::channels, data->size() - ptr);
+      size_t to_write = min(frames * Mixer::channels, samples - ptr);
 
-      copy(begin(*data) + ptr,
-            begin(*data) + ptr + to_write,
+      copy(data + ptr,
+            data + ptr + to_write,
             buffer);
 
       if (to_write < frames && loop())
       {
          rewind();
-         size_t to_write_loop = min(frames * Mixer::channels - to_write, data->size() - (ptr + to_write));
-         copy(begin(*data) + ptr + to_write,
-               begin(*data) + ptr + to_write + to_write_loop,
+         size_t to_write_loop = min(frames * Mixer::channels - to_write, samples - (ptr + to_write));
+         copy(data + ptr + to_write,
+               data + ptr + to_write + to_write_loop,
                buffer + to_write);
 
          to_write += to_write_loop;
@@ -65,13 +65,17 @@ namespace Audio
    {
       public:
          PCMStream(std::shared_ptr<std::vector<float>> data);
+         // Plays samples owned by someone else, e.g. a mapped asset pack.
+         PCMStream(const float* data, std::size_t samples, std::shared_ptr<const void> owner);
 
-         bool valid() const { return ptr < data->size(); }
+         bool valid() const { return ptr < samples; }
          void rewind() { ptr = 0; }
          std::size_t render(float* buffer, std::size_t frames);
 
       private:
-         std::shared_ptr<std::vector<float>> data;
+         std::shared_ptr<const void> owner;
+         const float* data;
+         std::size_t samples;
          std::atomic<std::size_t> ptr;
    };
 
@@ -1,5 +1,5 @@
 #include "game.hpp"
-#include <cstdlib>
+#include <ctime>
 
 using namespace std;
 
@@ -8,8 +8,46 @@ namespace Icy
    void BGManager::init(const vector<Track>& tracks)
    {
       this->tracks = tracks;
-      srand(time(nullptr));
+      rng = uint32_t(time(nullptr)) | 1;
       first = true;
+      last = 0;
+      current.reset();
+      loader = Audio::VorbisLoader();
+   }
+
+   // xorshift32, small enough to keep in savestates.
+   unsigned BGManager::random(unsigned range)
+   {
+      rng ^= rng << 13;
+      rng ^= rng >> 17;
+      rng ^= rng << 5;
+      return rng % range;
+   }
+
+   void BGManager::save_state(Blit::StateWriter& writer) const
+   {
+      writer.u32(rng);
+      writer.boolean(first);
+      writer.u32(last);
+   }
+
+   BGManager::State BGManager::read_state(Blit::StateReader& reader) const
+   {
+      State state;
+      state.rng   = reader.u32();
+      state.first = reader.boolean();
+      state.last  = reader.u32();
+
+      if (!state.rng || (!tracks.empty() && state.last >= tracks.size()))
+         throw runtime_error("Savestate has invalid music state.");
+      return state;
+   }
+
+   void BGManager::load_state(const State& state)
+   {
+      rng   = state.rng;
+      first = state.first;
+      last  = state.last;
    }
 
    void BGManager::step(Audio::Mixer& mixer)
@@ -31,7 +69,7 @@ namespace Icy
          }
          else
          {
-            unsigned index = rand() % tracks.size();
+            unsigned index = random(tracks.size());
             if (index == last)
                index = (index + 1) % tracks.size();
 
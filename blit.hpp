@@ -96,6 +96,14 @@ namespace Blit
             dst[x].set_if_alpha(src[x]);
       }
 
+      // Expands palette indices, skipping transparent entries.
+      static void set_line_if_alpha_indexed(self_type* dst, const std::uint8_t* src,
+            const self_type* palette, unsigned pix)
+      {
+         for (unsigned x = 0; x < pix; x++)
+            dst[x].set_if_alpha(palette[src[x]]);
+      }
+
       static void mask_rgb(self_type *dst, std::size_t size)
       {
          std::transform(dst, dst + size, dst, [](self_type pix) -> self_type { return pix & static_cast<self_type>(rgb_mask); });
@@ -195,6 +203,8 @@ namespace Blit
       Rect& operator-=(Pos pos)       { this->pos -= pos; return *this; }
       Rect  operator+ (Pos pos) const { return { this->pos + pos, w, h }; }
       Rect  operator- (Pos pos) const { return { this->pos - pos, w, h }; }
+      bool  operator==(Rect rect) const { return pos == rect.pos && w == rect.w && h == rect.h; }
+      bool  operator!=(Rect rect) const { return !(*this == rect); }
 
       // Intersection
       Rect  operator&(Rect rect) const
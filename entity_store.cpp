@@ -0,0 +1,49 @@
+#include "entity_store.hpp"
+
+using namespace Blit;
+using namespace std;
+
+namespace Icy
+{
+   EntityStore::EntityStore(Tilemap& map, const string& layer_name)
+   {
+      auto layer = map.find_layer(layer_name);
+      if (!layer)
+         return;
+
+      auto& elems = layer->cluster.vec();
+      entities.reserve(elems.size());
+      for (auto& elem : elems)
+      {
+         bool goal = Utils::find_or_default(elem.surf.attr(), "goal", "") == "true";
+         entities.push_back({move(elem.surf), elem.offset, goal});
+      }
+      elems.clear();
+
+      m_changed.reserve(entities.size());
+      is_changed.resize(entities.size());
+   }
+
+   void EntityStore::mark_changed(unsigned id)
+   {
+      if (!is_changed[id])
+      {
+         is_changed[id] = true;
+         m_changed.push_back(id);
+      }
+   }
+
+   void EntityStore::clear_changed()
+   {
+      for (auto id : m_changed)
+         is_changed[id] = false;
+      m_changed.clear();
+   }
+
+   void EntityStore::render(RenderTarget& target) const
+   {
+      for (auto& entity : entities)
+         target.blit_offset(entity.surf, {}, entity.offset);
+   }
+}
+
@@ -0,0 +1,48 @@
+#ifndef ENTITY_STORE_HPP__
+#define ENTITY_STORE_HPP__
+
+#include "tilemap.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Icy
+{
+   // Tiles that move, i.e. the pushable blocks of a level. They are taken out
+   // of their tile layer on load, so tile layers never change afterwards.
+   // Entities keep their index for as long as the level is loaded.
+   class EntityStore
+   {
+      public:
+         struct Entity
+         {
+            Blit::Surface surf;
+            Blit::Pos offset;
+            bool goal;
+         };
+
+         EntityStore() = default;
+         // Moves every tile of the named layer into the store, leaving the layer empty.
+         EntityStore(Blit::Tilemap& map, const std::string& layer);
+
+         unsigned size() const { return entities.size(); }
+         Entity& operator[](unsigned id) { return entities[id]; }
+         const Entity& operator[](unsigned id) const { return entities[id]; }
+
+         // Entities which moved since the last clear_changed(), each listed once.
+         void mark_changed(unsigned id);
+         const std::vector<unsigned>& changed() const { return m_changed; }
+         void clear_changed();
+
+         void render(Blit::RenderTarget& target) const;
+
+      private:
+         std::vector<Entity> entities;
+         std::vector<unsigned> m_changed;
+         std::vector<std::uint8_t> is_changed;
+   };
+}
+
+#endif
+
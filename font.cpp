@@ -1,10 +1,10 @@
 #include "font.hpp"
-#include "pugixml/pugixml.hpp"
+#include "xml_document.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
-using namespace pugi;
 using namespace std;
 
 namespace Blit
@@ -15,8 +15,8 @@ namespace Blit
    {
       auto dir = Utils::basedir(font);
 
-      xml_document doc;
-      if (!doc.load_file(font.c_str()))
+      XMLDocument doc;
+      if (!doc.load(font))
          throw runtime_error(Utils::join("Failed to load font: ", font, "."));
 
       auto glyph       = doc.child("font").child("glyphs");
@@ -60,8 +60,30 @@ namespace Blit
 
    void Font::set_color(Pixel pix)
    {
+      // Glyphs cut from an indexed font sheet share one recolored palette.
+      const Palette* orig = nullptr;
+      shared_ptr<const Palette> recolored;
+
       for (auto& itr : surf_map)
-         itr.second.refill_color(pix);
+      {
+         auto& surf = itr.second;
+         auto palette = surf.palette().get();
+         if (!palette)
+         {
+            surf.refill_color(pix);
+            continue;
+         }
+
+         if (palette != orig)
+         {
+            auto refilled = make_shared<Palette>(*palette);
+            refill_palette(*refilled, pix);
+            recolored = move(refilled);
+            orig = palette;
+         }
+
+         surf.set_palette(recolored);
+      }
    }
 
    void Font::render_msg(RenderTarget& target, const string& str, int x, int y,
@@ -96,13 +118,85 @@ namespace Blit
    
    void FontCluster::add_font(const string& font, Pos offset, Pixel color, string id)
    {
-      auto& fonts = fonts_map[move(id)];
+      // Every style using the same font shares one parse of it.
+      if (!fonts.count(font))
+         fonts[font] = Font{font};
+
+      auto& style = styles[move(id)];
+      style.layers.push_back({font, offset, color});
+      bake(style);
+      text_cache.clear();
+   }
+
+   void FontCluster::bake(Style& style)
+   {
+      auto& first = fonts.at(style.layers.front().font);
+      Pos glyph = first.glyph_size();
+
+      Pos min_offset = style.layers.front().offset;
+      Pos max_offset = min_offset;
+      for (auto& layer : style.layers)
+      {
+         if (fonts.at(layer.font).glyph_size() != glyph)
+            throw logic_error("Fonts of a style must have the same glyph size.");
+
+         min_offset = {min(min_offset.x, layer.offset.x), min(min_offset.y, layer.offset.y)};
+         max_offset = {max(max_offset.x, layer.offset.x), max(max_offset.y, layer.offset.y)};
+      }
+
+      // Cells overlap their neighbours where the lower layers stick out.
+      // Drawing away from that side keeps the top layer of each glyph visible.
+      auto top = style.layers.back().offset;
+      style.right_to_left = top.x > min_offset.x;
+      style.bottom_to_top = top.y > min_offset.y;
+      style.glyph_size    = glyph;
+      style.cell_size     = glyph + (max_offset - min_offset);
+      style.origin        = min_offset;
+
+      Pos cell = style.cell_size;
+      auto& chars = first.glyphs();
+      const int columns = 16;
+      int rows = (chars.size() + columns - 1) / columns;
+
+      vector<Font> colored;
+      for (auto& layer : style.layers)
+      {
+         colored.push_back(fonts.at(layer.font));
+         colored.back().set_color(layer.color);
+      }
+
+      RenderTarget target(columns * cell.x, rows * cell.y);
+      target.clear(Pixel());
+      style.glyphs.fill(Rect());
+
+      int index = 0;
+      for (auto& glyph : chars)
+      {
+         Pos pos{(index % columns) * cell.x, (index / columns) * cell.y};
+         index++;
 
-      OffsetFont tmp{font};
-      tmp.set_color(color);
-      tmp.offset = offset;
+         for (unsigned i = 0; i < style.layers.size(); i++)
+         {
+            auto& surfs = colored[i].glyphs();
+            auto itr = surfs.find(glyph.first);
+            if (itr != end(surfs))
+               target.blit_offset(itr->second, {}, pos + style.layers[i].offset - min_offset);
+         }
+
+         style.glyphs[static_cast<uint8_t>(glyph.first)] = {pos, cell.x, cell.y};
+      }
+
+      auto palette = make_shared<Palette>();
+      vector<uint8_t> indices;
+      if (index_pixels(target.buffer(), target.width() * target.height(), *palette, indices))
+      {
+         style.sheet = Surface{make_shared<Surface::Data>(move(indices), move(palette),
+               target.width(), target.height())};
+      }
+      else
+         style.sheet = target.convert_surface();
 
-      fonts.push_back(move(tmp));
+      style.sheet.ignore_camera(true);
    }
 
    void FontCluster::set_id(string id)
@@ -110,25 +204,18 @@ namespace Blit
       current_id = move(id);
    }
 
-   Pos FontCluster::glyph_size() const
+   const FontCluster::Style& FontCluster::current_style() const
    {
-      auto itr = fonts_map.find(current_id);
-      if (itr == end(fonts_map))
+      auto itr = styles.find(current_id);
+      if (itr == end(styles))
          throw runtime_error(Utils::join("Font ID: ", current_id, " not found in map!"));
 
-      auto& fonts = itr->second;
-
-      auto func_x = [](const OffsetFont& a, const OffsetFont& b) {
-         return a.glyph_size().x < b.glyph_size().x;
-      };
-      auto func_y = [](const OffsetFont& a, const OffsetFont& b) {
-         return a.glyph_size().y < b.glyph_size().y;
-      };
-
-      auto max_x = max_element(begin(fonts), end(fonts), func_x);
-      auto max_y = max_element(begin(fonts), end(fonts), func_y);
+      return itr->second;
+   }
 
-      return {max_x->glyph_size().x, max_y->glyph_size().y};
+   Pos FontCluster::glyph_size() const
+   {
+      return current_style().glyph_size;
    }
 
    void FontCluster::render_msg(RenderTarget& target, const string& msg,
@@ -136,23 +223,142 @@ namespace Blit
          Font::RenderAlignment dir,
          int newline_offset) const
    {
-      auto itr = fonts_map.find(current_id);
-      if (itr == end(fonts_map))
-         throw runtime_error(Utils::join("Font ID: ", current_id, " not found in map!"));
-
-      for (auto& font : itr->second)
-         font.render_msg(target, msg, x, y, dir, newline_offset);
+      render_msg(target, msg.c_str(), x, y, dir, newline_offset);
    }
 
-   FontCluster::OffsetFont::OffsetFont(const string& font) : Font(font)
-   {}
-
-   void FontCluster::OffsetFont::render_msg(RenderTarget& target, const string& msg,
+   void FontCluster::render_msg(RenderTarget& target, const char* msg,
          int x, int y,
          Font::RenderAlignment dir,
          int newline_offset) const
    {
-      Font::render_msg(target, msg, x + offset.x, y + offset.y, dir, newline_offset);
+      auto& text = cached_text(current_style(), msg, dir, newline_offset);
+      if (text.surf.rect())
+         target.blit_offset(text.surf, {}, Pos{x, y} + text.offset);
    }
-}
 
+   const FontCluster::CachedText& FontCluster::cached_text(const Style& style, const char* new_msg,
+         Font::RenderAlignment dir, int newline_offset) const
+   {
+      auto itr = find_if(begin(text_cache), end(text_cache), [&](const CachedText& text) {
+               return text.msg == new_msg && text.dir == dir &&
+                  text.newline_offset == newline_offset && text.id == current_id;
+            });
+
+      if (itr != end(text_cache))
+      {
+         itr->last_use = ++text_clock;
+         return *itr;
+      }
+
+      // Reuses the storage of the evicted entry. It leaves the cache first, and
+      // the new one only goes in once rendered, so a throw leaves nothing stale.
+      CachedText text;
+      if (text_cache.size() >= text_cache_size)
+      {
+         itr = min_element(begin(text_cache), end(text_cache), [](const CachedText& a, const CachedText& b) {
+                  return a.last_use < b.last_use;
+               });
+         text = move(*itr);
+         text_cache.erase(itr);
+      }
+
+      text.msg = new_msg;
+      auto& msg = text.msg;
+
+      // Bounds of all glyph cells, relative to the pen.
+      Pos glyph = style.glyph_size;
+      Pos cell  = style.cell_size;
+
+      int lines = count(begin(msg), end(msg), '\n') + 1;
+      int left = 0, right = 0;
+      size_t first = 0;
+      for (int line = 0; line < lines; line++)
+      {
+         size_t last = msg.find('\n', first);
+         if (last == string::npos)
+            last = msg.size();
+
+         int len = last - first;
+         int x = -align_x(style, len, dir);
+         if (line == 0 || x < left)
+            left = x;
+         if (line == 0 || x + len * glyph.x > right)
+            right = x + len * glyph.x;
+
+         first = last + 1;
+      }
+
+      Rect bounds{Pos{left, 0} + style.origin,
+         right - left + cell.x - glyph.x,
+         lines * (glyph.y + newline_offset) - newline_offset + cell.y - glyph.y};
+
+      text.id             = current_id;
+      text.dir            = dir;
+      text.newline_offset = newline_offset;
+      text.offset         = bounds.pos;
+      text.last_use       = ++text_clock;
+
+      text.surf = Surface{};
+      if (bounds)
+      {
+         RenderTarget canvas(bounds.w, bounds.h);
+         draw_text(canvas, style, msg, -bounds.pos, dir, newline_offset);
+
+         auto palette = make_shared<Palette>();
+         vector<uint8_t> indices;
+         if (index_pixels(canvas.buffer(), bounds.w * bounds.h, *palette, indices))
+            text.surf = Surface{make_shared<Surface::Data>(move(indices), move(palette), bounds.w, bounds.h)};
+         else
+            text.surf = canvas.convert_surface();
+
+         text.surf.ignore_camera(true);
+      }
+
+      text_cache.push_back(move(text));
+      return text_cache.back();
+   }
+
+   int FontCluster::align_x(const Style& style, int len, Font::RenderAlignment dir)
+   {
+      if (dir == Font::RenderAlignment::Right)
+         return style.glyph_size.x * len;
+      if (dir == Font::RenderAlignment::Centered)
+         return style.glyph_size.x * len / 2;
+      return 0;
+   }
+
+   void FontCluster::draw_text(RenderTarget& target, const Style& style, const string& msg,
+         Pos pen, Font::RenderAlignment dir, int newline_offset)
+   {
+      Pos glyph = style.glyph_size;
+
+      size_t lines = count(begin(msg), end(msg), '\n') + 1;
+      for (size_t l = 0; l < lines; l++)
+      {
+         size_t line = style.bottom_to_top ? lines - 1 - l : l;
+
+         size_t first = 0;
+         for (size_t n = 0; n < line; n++)
+            first = msg.find('\n', first) + 1;
+         size_t last = msg.find('\n', first);
+         if (last == string::npos)
+            last = msg.size();
+
+         int len = last - first;
+         Pos line_pen{pen.x - align_x(style, len, dir), pen.y + int(line) * (glyph.y + newline_offset)};
+
+         for (int i = 0; i < len; i++)
+         {
+            int col = style.right_to_left ? len - 1 - i : i;
+            char c = msg[first + col];
+
+            auto& rect = style.glyphs[static_cast<uint8_t>(c)];
+            if (!rect)
+               throw logic_error(Utils::join("Character '", c, "' not found in font."));
+
+            Pos cell = line_pen + Pos{col * glyph.x, 0} + style.origin;
+            target.blit_offset(style.sheet, rect, cell - rect.pos);
+         }
+      }
+   }
+}
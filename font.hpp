@@ -2,7 +2,10 @@
 #define FONT_HPP__
 
 #include "surface.hpp"
+#include <array>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace Blit
 {
@@ -17,6 +20,7 @@ namespace Blit
          Font& operator=(Font&&) = default;
 
          const Surface& surface(char c) const; 
+         const std::map<char, Surface>& glyphs() const { return surf_map; }
          Pos glyph_size() const { return { glyphwidth, glyphheight }; }
 
          enum class RenderAlignment : unsigned
@@ -52,24 +56,58 @@ namespace Blit
          void set_id(std::string id);
          void render_msg(RenderTarget& target, const std::string& msg, int x, int y,
                Font::RenderAlignment dir = Font::RenderAlignment::Left, int newline_offset = 0) const;
+         void render_msg(RenderTarget& target, const char* msg, int x, int y,
+               Font::RenderAlignment dir = Font::RenderAlignment::Left, int newline_offset = 0) const;
 
       private:
-         struct OffsetFont : public Font
+         // All fonts added under one ID, composited into a single glyph sheet.
+         // Later fonts are drawn over earlier ones, e.g. a face over its shadow.
+         struct Style
          {
-            OffsetFont() = default;
-            OffsetFont(const std::string& font);
-            OffsetFont(const OffsetFont&) = default;
-            OffsetFont& operator=(const OffsetFont&) = default;
-            OffsetFont(OffsetFont&&) = default;
-            OffsetFont& operator=(OffsetFont&&) = default;
-
-            void render_msg(RenderTarget& target, const std::string& msg, int x, int y,
-                  Font::RenderAlignment dir, int newline_offset) const;
-            Pos offset;
+            struct Layer
+            {
+               std::string font;
+               Pos offset;
+               Pixel color;
+            };
+            std::vector<Layer> layers;
+
+            Surface sheet;
+            std::array<Rect, 256> glyphs; // Cell of each character in sheet.
+            Pos glyph_size;
+            Pos cell_size;
+            Pos origin;                   // Of the cells, relative to the pen.
+            bool right_to_left;           // Draw order keeping faces over neighbouring shadows.
+            bool bottom_to_top;
          };
 
-         std::map<std::string, std::vector<OffsetFont>> fonts_map;
+         std::map<std::string, Font> fonts;
+         std::map<std::string, Style> styles;
          std::string current_id;
+
+         // Recently rendered messages, as most text is the same every frame.
+         struct CachedText
+         {
+            std::string id;
+            std::string msg;
+            Font::RenderAlignment dir;
+            int newline_offset;
+
+            Surface surf;
+            Pos offset; // Of surf, relative to the pen.
+            unsigned last_use;
+         };
+         enum { text_cache_size = 16 };
+         mutable std::vector<CachedText> text_cache;
+         mutable unsigned text_clock = 0;
+
+         const Style& current_style() const;
+         void bake(Style& style);
+         const CachedText& cached_text(const Style& style, const char* msg,
+               Font::RenderAlignment dir, int newline_offset) const;
+         static void draw_text(RenderTarget& target, const Style& style, const std::string& msg,
+               Pos pen, Font::RenderAlignment dir, int newline_offset);
+         static int align_x(const Style& style, int len, Font::RenderAlignment dir);
    };
 }
 
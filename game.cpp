@@ -1,7 +1,9 @@
 #include "game.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
 
 using namespace Blit;
 using namespace std;
@@ -18,25 +20,237 @@ namespace Icy
       return ret;
    }
 
-   Game::Game(const string& level_path, unsigned chapter, unsigned level, unsigned best_pushes, Blit::FontCluster& font)
-      : map(level_path), target(fb_width, fb_height), font(&font),
+   Game::Game(const string& level_path, unsigned chapter, unsigned level, unsigned best_pushes, Blit::FontCluster& font,
+         bool headless)
+      : map(level_path), entities(map, "blocks"), slides(map, entities), headless(headless),
+         target(fb_width, fb_height), font(&font),
          camera(target, player.rect(), {map.pix_width(), map.pix_height()}),
-         won_frame_cnt(0), is_sliding(false), best_pushes(best_pushes), pushes(0), 
-         chapter(chapter), level(level), push(true) 
+         won_frame_cnt(0), frame_cnt(0), player_walking(false), is_sliding(false),
+         best_pushes(best_pushes), pushes(0), chapter(chapter), level(level),
+         push(true), undo(true), redo(true), hint(true)
    {
       m_won_early = false;
+      if (entities.size() > max_entities)
+         throw runtime_error(Utils::join("Level has more than ", unsigned(max_entities), " blocks: ", level_path));
+
       set_initial_pos(level_path);
+      if (!headless)
+         cache_static_layers();
+      find_goals();
       bg = nullptr;
+      take_pristine();
    }
 
    Game::Game(const string& level_path)
-      : map(level_path), target(fb_width, fb_height), font(nullptr),
+      : map(level_path), entities(map, "blocks"), slides(map, entities), headless(false),
+         target(fb_width, fb_height), font(nullptr),
          camera(target, player.rect(), {map.pix_width(), map.pix_height()}),
-         won_frame_cnt(0), is_sliding(false), push(true) 
+         won_frame_cnt(0), frame_cnt(0), player_walking(false), is_sliding(false),
+         best_pushes(0), pushes(0), chapter(0), level(0),
+         push(true), undo(true), redo(true), hint(true)
    {
       m_won_early = false;
+      if (entities.size() > max_entities)
+         throw runtime_error(Utils::join("Level has more than ", unsigned(max_entities), " blocks: ", level_path));
+
       set_initial_pos(level_path);
+      cache_static_layers();
+      find_goals();
       bg = nullptr;
+      take_pristine();
+   }
+
+   Game::~Game()
+   {
+      // Nobody is going to see the hint, so do not wait for it.
+      if (m_hint.job.valid())
+         m_hint.solver->cancel();
+   }
+
+   void Game::save_state(StateWriter& writer) const
+   {
+      writer.u16(chapter);
+      writer.u16(level);
+      writer.u32(best_pushes);
+      writer.u32(pushes);
+      writer.u32(won_frame_cnt);
+      writer.boolean(m_won_early);
+      writer.u32(frame_cnt);
+      writer.boolean(player_walking);
+      writer.boolean(is_sliding);
+      writer.u8(static_cast<uint8_t>(facing));
+      writer.boolean(push.state());
+      writer.boolean(undo.state());
+      writer.boolean(redo.state());
+
+      writer.pos(player.rect().pos);
+      writer.pos(player_off);
+      writer.u32(player.active_alt());
+      writer.u32(player.active_alt_index());
+
+      writer.u16(entities.size());
+      for (unsigned id = 0; id < entities.size(); id++)
+      {
+         auto& entity = entities[id];
+         writer.pos(entity.surf.rect().pos);
+         writer.pos(entity.offset);
+         writer.u32(entity.surf.active_alt());
+         writer.u32(entity.surf.active_alt_index());
+      }
+
+      // Motions refer to what they move by entity ID, -1 for the player and -2 for nothing.
+      writer.u8(motions.size());
+      for (unsigned i = 0; i < motions.size(); i++)
+      {
+         auto& motion = motions[i];
+         int16_t surf = motion.entity >= 0 ? motion.entity : (motion.surf == &player ? -1 : -2);
+
+         writer.u8(static_cast<uint8_t>(motion.kind));
+         writer.u16(surf);
+         writer.pos(motion.dir);
+         writer.pos(motion.dest);
+         writer.u32(motion.frame);
+      }
+
+      history.save_state(writer);
+   }
+
+   void Game::load_state(StateReader& reader)
+   {
+      // Everything is read and checked before any of it is applied,
+      // so a savestate which fails to load leaves the level as it was.
+      if (reader.u16() != chapter || reader.u16() != level)
+         throw runtime_error("Savestate is for a different level.");
+
+      unsigned loaded_best_pushes   = reader.u32();
+      unsigned loaded_pushes        = reader.u32();
+      unsigned loaded_won_frame_cnt = reader.u32();
+      bool loaded_won_early         = reader.boolean();
+      unsigned loaded_frame_cnt     = reader.u32();
+      bool loaded_walking           = reader.boolean();
+      bool loaded_sliding           = reader.boolean();
+
+      unsigned face = reader.u8();
+      if (face > static_cast<unsigned>(Input::Right))
+         throw runtime_error("Savestate has invalid facing.");
+      bool push_state = reader.boolean();
+      bool undo_state = reader.boolean();
+      bool redo_state = reader.boolean();
+
+      Pos player_pos = reader.pos();
+      Pos loaded_player_off = reader.pos();
+      unsigned player_alt = reader.u32();
+      unsigned player_alt_index = reader.u32();
+      if (!player.has_alt(player_alt, player_alt_index))
+         throw runtime_error("Savestate has an invalid player sprite.");
+
+      if (reader.u16() != entities.size())
+         throw runtime_error("Savestate does not match the blocks of this level.");
+
+      struct EntityState
+      {
+         Pos pos, offset;
+         unsigned alt, index;
+      };
+      array<EntityState, max_entities> entity_states;
+      for (unsigned id = 0; id < entities.size(); id++)
+      {
+         auto& entity = entity_states[id];
+         entity.pos    = reader.pos();
+         entity.offset = reader.pos();
+         entity.alt    = reader.u32();
+         entity.index  = reader.u32();
+
+         // Blocks without this alt keep their sprite.
+         auto& surf = entities[id].surf;
+         if (surf.has_alt(entity.alt) && !surf.has_alt(entity.alt, entity.index))
+            throw runtime_error("Savestate has an invalid block sprite.");
+      }
+
+      MotionScheduler loaded_motions;
+      unsigned count = reader.u8();
+      if (count > MotionScheduler::capacity)
+         throw runtime_error("Savestate has too many motions.");
+
+      for (unsigned i = 0; i < count; i++)
+      {
+         unsigned kind = reader.u8();
+         int surf      = int16_t(reader.u16());
+         Pos dir       = reader.pos();
+         Pos dest      = reader.pos();
+         unsigned frame = reader.u32();
+
+         if (kind > static_cast<unsigned>(MotionScheduler::Kind::Win) ||
+               surf < -2 || surf >= int(entities.size()))
+            throw runtime_error("Savestate has an invalid motion.");
+
+         Surface* target_surf = surf >= 0 ? &entities[surf].surf : (surf == -1 ? &player : nullptr);
+         loaded_motions.start(static_cast<MotionScheduler::Kind>(kind), target_surf, max(surf, -1), dir, dest);
+         loaded_motions[i].frame = frame;
+      }
+
+      UndoStack loaded_history;
+      loaded_history.load_state(reader);
+
+      // Nothing below can fail.
+      best_pushes    = loaded_best_pushes;
+      pushes         = loaded_pushes;
+      won_frame_cnt  = loaded_won_frame_cnt;
+      m_won_early    = loaded_won_early;
+      frame_cnt      = loaded_frame_cnt;
+      player_walking = loaded_walking;
+      is_sliding     = loaded_sliding;
+      facing         = static_cast<Input>(face);
+      push = EdgeDetector(push_state);
+      undo = EdgeDetector(undo_state);
+      redo = EdgeDetector(redo_state);
+
+      player.rect().pos = player_pos;
+      player_off = loaded_player_off;
+      player.active_alt(player_alt, player_alt_index);
+
+      for (unsigned id = 0; id < entities.size(); id++)
+      {
+         auto& entity = entities[id];
+         auto& state  = entity_states[id];
+         entity.surf.rect().pos = state.pos;
+         entity.offset = state.offset;
+         if (entity.surf.has_alt(state.alt))
+            entity.surf.active_alt(state.alt, state.index);
+      }
+      entities.clear_changed();
+
+      motions = loaded_motions;
+      history = loaded_history;
+
+      // A pushed block owns its destination tile for as long as it slides.
+      slides.place_blocks(entities.size(), [this](unsigned id) {
+               for (unsigned i = 0; i < motions.size(); i++)
+                  if (motions[i].entity == int(id))
+                     return motions[i].dest;
+               return tile_pos(entities[id].surf);
+            });
+      find_stuck();
+   }
+
+   void Game::take_pristine()
+   {
+      pristine.resize(state_size);
+      StateWriter writer{pristine.data(), pristine.size()};
+      save_state(writer);
+      writer.pad();
+   }
+
+   void Game::reset()
+   {
+      unsigned best = best_pushes;
+      StateReader reader{pristine.data(), pristine.size()};
+      load_state(reader);
+      best_pushes = best;
+
+      // As on load, the first frame checks the goals.
+      for (auto id : goal_blocks)
+         entities.mark_changed(id);
    }
 
    void Game::set_bg(const Blit::Surface& bg)
@@ -68,9 +282,17 @@ namespace Icy
       player.active_alt(face);
    }
 
-   void Game::iterate()
+   void Game::iterate(bool present)
    {
       update_player();
+      if (present)
+         render();
+   }
+
+   void Game::render()
+   {
+      if (headless)
+         return;
 
       if (bg)
          target.blit(*bg, {});
@@ -79,24 +301,73 @@ namespace Icy
 
       camera.update();
 
-      map.render(target);
+      target.blit(static_below, {});
+      entities.render(target);
+      target.blit(static_above, {});
       target.blit_offset(player, {}, player_off);
 
       if (font)
       {
+         // A block can win the level while it slides on to a dead tile,
+         // so the prompt waits until everything has come to rest.
+         if (stuck && !motions.active())
+         {
+            font->set_id("white");
+            font->render_msg(target, "Unsolvable! Undo or reset?", 2, 2);
+         }
+         else if (!stuck)
+            render_hint();
+
          font->set_id("lime");
          font->render_msg(target, 
-               Utils::join((chapter + 1), "-", (level + 1)), 314, 184, Font::RenderAlignment::Right);
+               Utils::format<16>((chapter + 1), "-", (level + 1)).c_str(), 314, 184, Font::RenderAlignment::Right);
          if (!best_pushes)
-            font->render_msg(target, Utils::join(" Pushes:", pushes), 2, 184);
+            font->render_msg(target, Utils::format<32>(" Pushes:", pushes).c_str(), 2, 184);
          else
-            font->render_msg(target, Utils::join(" Pushes:", pushes, " Best:", best_pushes), 2, 184);
+            font->render_msg(target, Utils::format<48>(" Pushes:", pushes, " Best:", best_pushes).c_str(), 2, 184);
       }
 
       if (m_video_cb)
          m_video_cb(target.buffer(), target.width(), target.height(), target.width() * sizeof(Pixel));
    }
 
+   void Game::cache_static_layers()
+   {
+      int blocks = map.find_layer_index("blocks");
+      int last   = map.layers().size() - 1;
+
+      RenderTarget below(map.pix_width(), map.pix_height());
+      if (blocks < 0)
+         map.render(below);
+      else
+         map.render_until_layer(blocks, below);
+      static_below = below.convert_surface();
+
+      if (blocks >= 0 && blocks < last)
+      {
+         RenderTarget above(map.pix_width(), map.pix_height());
+         map.render_after_layer(blocks, above);
+         static_above = above.convert_surface();
+      }
+   }
+
+   void Game::find_goals()
+   {
+      for (auto& tile : get_tiles_with_attr("floor", "goal", "true"))
+         goal_floor.push_back(tile.get().surf.rect().pos);
+      sort(begin(goal_floor), end(goal_floor));
+
+      for (unsigned id = 0; id < entities.size(); id++)
+      {
+         if (entities[id].goal)
+         {
+            goal_blocks.push_back(id);
+            entities.mark_changed(id);
+         }
+      }
+      goal_scratch.reserve(goal_blocks.size());
+   }
+
    vector<reference_wrapper<SurfaceCluster::Elem>> Game::get_tiles_with_attr(const string& name,
          const string& attr, const string& val)
    {
@@ -121,33 +392,33 @@ namespace Icy
    {
       won_frame_cnt++;
 
-      auto goal_blocks = get_tiles_with_attr("blocks", "goal", "true");
-
       const unsigned frame_per_iter = 24;
 
-      auto state = "frozen";
+      auto& alts = alt_ids();
+      unsigned state = alts.frozen;
       if (won_frame_cnt >= 3 * frame_per_iter)
       {
          bool jump = ((won_frame_cnt / frame_per_iter - 3) >> 1) & 1;
          unsigned last_jump = (((won_frame_cnt - 1) / frame_per_iter - 3) >> 1) & 1;
-         state = jump ? "cheer" : "down";
+         state = jump ? alts.cheer : alts.down;
          player.active_alt(state);
 
          if (jump && !last_jump)
-            get_sfx().play_sfx("dino_jump", 0.4);
+            play_sfx("dino_jump", 0.4);
       }
       else if (won_frame_cnt >= 2 * frame_per_iter)
-         state = "defrost2";
+         state = alts.defrost2;
       else if (won_frame_cnt >= 1 * frame_per_iter)
-         state = "defrost1";
+         state = alts.defrost1;
 
-      for (auto& block : goal_blocks)
+      for (auto id : goal_blocks)
       {
-         block.get().surf.active_alt(state);
+         auto& block = entities[id];
+         block.surf.active_alt(state);
 
          // Shift defrosted block same way player sprite is (16x17, etc), but only when defrost kicks in.
          if (won_frame_cnt >= 1 * frame_per_iter)
-            block.get().offset = player_off;
+            block.offset = player_off;
       }
 
       m_won_early = (won_frame_cnt >= frame_per_iter * 3) && push.set(m_input_cb(Input::Push));
@@ -161,8 +432,9 @@ namespace Icy
 
       push.set(true); // Avoid exiting win animation early.
       m_won_early = false;
-      stepper = bind(&Game::win_animation_stepper, this);
-      get_sfx().play_sfx("frozen_dino_melt", 0.25);
+      motions.clear();
+      motions.start(MotionScheduler::Kind::Win);
+      play_sfx("frozen_dino_melt", 0.25);
    }
 
    bool Game::won() const
@@ -173,26 +445,18 @@ namespace Icy
    // Checks if all goals on floor and blocks are aligned with each other.
    bool Game::won_condition()
    {
-      auto goal_floor  = get_tiles_with_attr("floor", "goal", "true");
-      auto goal_blocks = get_tiles_with_attr("blocks", "goal", "true");
-
       if (goal_floor.size() != goal_blocks.size())
          throw logic_error("Number of goal floors and goal blocks do not match.");
 
       if (goal_floor.empty() || goal_blocks.empty())
          throw logic_error("Goal floor or blocks are empty.");
 
-      auto func = [](const SurfaceCluster::Elem& a, const SurfaceCluster::Elem& b) {
-         return a.surf.rect().pos < b.surf.rect().pos;
-      };
-
-      sort(begin(goal_floor), end(goal_floor), func);
-      sort(begin(goal_blocks), end(goal_blocks), func);
+      goal_scratch.clear();
+      for (auto id : goal_blocks)
+         goal_scratch.push_back(entities[id].surf.rect().pos);
+      sort(begin(goal_scratch), end(goal_scratch));
 
-      return equal(begin(goal_floor), end(goal_floor),
-            begin(goal_blocks), [](const SurfaceCluster::Elem& a, const SurfaceCluster::Elem& b) {
-               return a.surf.rect().pos == b.surf.rect().pos;
-            });
+      return goal_scratch == goal_floor;
    }
 
    void Game::update_player()
@@ -200,31 +464,33 @@ namespace Icy
       if (!m_input_cb)
          return;
       
-      bool had_stepper = static_cast<bool>(stepper);
-      run_stepper();
+      bool had_motion = motions.active();
+      run_motions();
 
       if (won_frame_cnt)
          return;
 
-      if (!stepper)
+      if (!motions.active())
          update_input();
       else
          update_triggers();
 
       // Reset animation.
-      if (!had_stepper && stepper)
+      if (!had_motion && motions.active())
          frame_cnt = 0;
-      else if (!stepper)
+      else if (!motions.active())
       {
          frame_cnt = 0;
          player.active_alt_index(0);
       }
 
-      if (stepper && player_walking)
+      if (motions.active() && player_walking)
          update_animation();
 
-      if (won_condition())
+      // Only blocks that reached a tile since last frame can complete a goal.
+      if (!entities.changed().empty() && won_condition())
          prepare_won_animation();
+      entities.clear_changed();
    }
 
    void Game::update_animation()
@@ -246,11 +512,102 @@ namespace Icy
       push.set(m_input_cb(Input::Push));
    }
 
+   uint64_t Game::position_key() const
+   {
+      uint64_t key = slides.tile_index(tile_pos(player));
+      for (unsigned id = 0; id < entities.size(); id++)
+         key = (key * 0x100000001b3ull) ^ slides.tile_index(tile_pos(entities[id].surf));
+      return key;
+   }
+
+   void Game::start_hint()
+   {
+      // Stuck already says there is no solution, and headless nobody would see one.
+      if (stuck || headless)
+         return;
+
+      auto position = position_key();
+      if (m_hint.position == position && (m_hint.ready || m_hint.job.valid()))
+         return;
+
+      if (m_hint.job.valid())
+      {
+         m_hint.solver->cancel();
+         m_hint.job.wait();
+      }
+
+      m_hint = Hint();
+      m_hint.position = position;
+
+      try
+      {
+         // A core is left to the game, which runs on.
+         m_hint.solver = make_shared<Solver>(puzzle(), max(thread::hardware_concurrency(), 2u) - 1, hint_max_states);
+      }
+      catch (const runtime_error&)
+      {
+         // Too large for the solver.
+         Solver::Result result;
+         result.exhausted = true;
+         finish_hint(result);
+         return;
+      }
+
+      auto solver = m_hint.solver;
+      m_hint.job = async(launch::async, [solver] { return solver->solve(); });
+   }
+
+   // Takes the result of the solver, and what is shown of it.
+   void Game::finish_hint(Solver::Result result)
+   {
+      m_hint.result = move(result);
+      m_hint.ready = true;
+
+      unsigned left = m_hint.result.pushes.size();
+      if (m_hint.result.solved)
+         m_hint.message = Utils::format<48>("Hint: ", left, left == 1 ? " push" : " pushes", " to go");
+      else if (m_hint.result.exhausted)
+         m_hint.message = Utils::format<48>("Hint: Too far from a solution");
+      else
+         m_hint.message = Utils::format<48>("Hint: No solution from here");
+
+      if (left)
+      {
+         auto& next = m_hint.result.pushes.front();
+         m_hint.ghost = entities[slides.block(next.player + next.dir)].surf;
+         m_hint.ghost.rect().pos = next.block_dest * Pos{map.tile_width(), map.tile_height()};
+      }
+   }
+
+   void Game::render_hint()
+   {
+      if (m_hint.job.valid() && m_hint.job.wait_for(chrono::seconds(0)) == future_status::ready)
+         finish_hint(m_hint.job.get());
+
+      if (m_hint.position != position_key() || !(m_hint.ready || m_hint.job.valid()))
+         return;
+
+      if (m_hint.ready && !m_hint.result.pushes.empty() && ((m_hint.frame++ / 16) & 1))
+         target.blit(m_hint.ghost, {});
+
+      font->set_id("white");
+      font->render_msg(target, m_hint.ready ? m_hint.message.c_str() : "Hint: Thinking ...", 2, 2);
+   }
+
    void Game::update_input()
    {
       bool push_trigger = push.set(m_input_cb(Input::Push));
+      bool undo_trigger = undo.set(m_input_cb(Input::Undo));
+      bool redo_trigger = redo.set(m_input_cb(Input::Redo));
 
-      if (push_trigger)
+      if (hint.set(m_input_cb(Input::Hint)))
+         start_hint();
+
+      if (undo_trigger)
+         undo_move();
+      else if (redo_trigger)
+         redo_move();
+      else if (push_trigger)
          push_block();
       else if (m_input_cb(Input::Up))
          move_if_no_collision(Input::Up);
@@ -262,16 +619,27 @@ namespace Icy
          move_if_no_collision(Input::Right);
    }
 
-   string Game::input_to_string(Input input)
+   Puzzle Game::puzzle() const
    {
-      switch (input)
-      {
-         case Input::Up:    return "up";
-         case Input::Left:  return "left";
-         case Input::Right: return "right";
-         case Input::Down:  return "down";
-         default:           return "";
-      }
+      return Puzzle(slides, entities, tile_pos(player));
+   }
+
+   const Game::AltIDs& Game::alt_ids()
+   {
+      static const AltIDs ids = {
+         {
+            Surface::alt_id("up"),
+            Surface::alt_id("down"),
+            Surface::alt_id("left"),
+            Surface::alt_id("right"),
+         },
+         Surface::alt_id("frozen"),
+         Surface::alt_id("defrost1"),
+         Surface::alt_id("defrost2"),
+         Surface::alt_id("cheer"),
+         Surface::alt_id("down"),
+      };
+      return ids;
    }
 
    Blit::Pos Game::input_to_offset(Input input)
@@ -295,111 +663,294 @@ namespace Icy
       return Input::None;
    }
 
-   bool Game::is_offset_collision(Surface& surf, Pos offset)
+   Pos Game::tile_pos(const Surface& surf) const
    {
-      auto new_rect = surf.rect() + offset;
+      return {surf.rect().pos.x / map.tile_width(), surf.rect().pos.y / map.tile_height()};
+   }
 
+   bool Game::is_offset_collision(Surface& surf, Pos offset)
+   {
       // Always assume that the rect in question is inside a single tile.
       // This is needed as the dino sprite can be slightly larger than 16x16, but it's
       // *assumed* from a collition detection POV that a surface is tile sized to simplify things.
-      new_rect.w = map.tile_width();
-      new_rect.h = map.tile_height();
-
       bool outside_grid = surf.rect().pos.x % map.tile_width() || surf.rect().pos.y % map.tile_height();
       if (outside_grid)
          throw logic_error("Offset collision check was performed outside tile grid.");
 
-      int current_x = surf.rect().pos.x / map.tile_width();
-      int current_y = surf.rect().pos.y / map.tile_height();
-
-      int min_tile_x = new_rect.pos.x / map.tile_width();
-      int max_tile_x = (new_rect.pos.x + new_rect.w - 1) / map.tile_width();
-
-      int min_tile_y = new_rect.pos.y / map.tile_height();
-      int max_tile_y = (new_rect.pos.y + new_rect.h - 1) / map.tile_height();
-
-      for (int y = min_tile_y; y <= max_tile_y; y++)
-         for (int x = min_tile_x; x <= max_tile_x; x++)
-            if (Pos{x, y} != Pos{current_x, current_y} && map.collision({x, y})) // Can't collide against ourselves.
-               return true;
-
-      return false;
+      return slides.blocked(tile_pos(surf) + offset);
    }
 
    void Game::push_block()
    {
-      auto offset = input_to_offset(facing);
-      auto dir    = offset * Pos{map.tile_width(), map.tile_height()};
-      auto tile   = map.find_tile("blocks", player.rect().pos + dir);
+      auto offset   = input_to_offset(facing);
+      auto from     = tile_pos(player) + offset;
+      int id        = slides.block(from);
 
-      if (!tile)
+      if (id < 0)
          return;
 
-      int tile_x = player.rect().pos.x / map.tile_width();
-      int tile_y = player.rect().pos.y / map.tile_height();
-      Pos tile_pos{tile_x, tile_y};
-
-      if (!map.collision(tile_pos + (2 * offset)))
+      if (!slides.blocked(from + offset))
       {
-         stepper = bind(&Game::tile_stepper, this, ref(*tile), offset);
-         stepper_cnt = 0;
+         auto dest = slides.destination(from, offset, SlideMap::Mover::Block);
+         slides.move_block(from, dest);
+
+         // Only the pushed block can have become stuck.
+         stuck = stuck || stuck_at(dest);
+
+         auto face = static_cast<uint8_t>(facing);
+         history.record({int8_t(id), 1, face, face,
+               uint16_t(slides.tile_index(from)), uint16_t(slides.tile_index(dest))});
+
+         motions.start(MotionScheduler::Kind::Push, &entities[id].surf, id, offset, dest);
          player_walking = false;
          player.active_alt_index(0);
-         get_sfx().play_sfx("dino_push", 1.0);
+         play_sfx("dino_push", 1.0);
          pushes++;
       }
    }
 
+   void Game::play_sfx(const char* ident, float volume)
+   {
+      if (!headless)
+         get_sfx().play_sfx(ident, volume);
+   }
+
    void Game::move_if_no_collision(Input input)
    {
+      auto facing_before = static_cast<uint8_t>(facing);
       facing = input;
-      player.active_alt(input_to_string(facing));
+      player.active_alt(alt_ids().facing[static_cast<unsigned>(input)]);
 
       auto offset = input_to_offset(input);
       if (!is_offset_collision(player, offset))
       {
-         stepper = bind(&Game::tile_stepper, this, ref(player), offset);
+         auto from = tile_pos(player);
+         auto dest = slides.destination(from, offset, SlideMap::Mover::Player);
+         history.record({-1, 0, facing_before, static_cast<uint8_t>(input),
+               uint16_t(slides.tile_index(from)), uint16_t(slides.tile_index(dest))});
+         motions.start(MotionScheduler::Kind::Walk, &player, -1, offset, dest);
          player_walking = true;
       }
    }
 
-   bool Game::tile_stepper(Surface& surf, Pos step_dir)
+   // A goal block can land on a dead tile, or blocks can end up in a 2x2
+   // square of walls and blocks, where none of them can be pushed again.
+   // Such a square is only a loss if a block in it is misplaced.
+   bool Game::stuck_at(Pos tile) const
+   {
+      int id = slides.block(tile);
+      if (id >= 0 && entities[id].goal && slides.dead(tile))
+         return true;
+
+      auto misplaced = [this](Pos tile) {
+         int id = slides.block(tile);
+         return id >= 0 && entities[id].goal != slides.goal(tile);
+      };
+
+      static const Pos squares[4] = { {-1, -1}, {0, -1}, {-1, 0}, {0, 0} };
+      for (auto& corner : squares)
+      {
+         Pos square[4] = {
+            tile + corner, tile + corner + Pos{1, 0},
+            tile + corner + Pos{0, 1}, tile + corner + Pos{1, 1},
+         };
+
+         if (all_of(begin(square), end(square), [this](Pos tile) { return slides.blocked(tile); }) &&
+               any_of(begin(square), end(square), misplaced))
+            return true;
+      }
+
+      return false;
+   }
+
+   void Game::find_stuck()
+   {
+      // Blocks are taken from the slide tables, which already hold
+      // sliding blocks where they come to rest.
+      stuck = false;
+      unsigned tiles = slides.width() * slides.height();
+      for (unsigned i = 0; i < tiles && !stuck; i++)
+      {
+         Pos tile = slides.tile_at(i);
+         stuck = slides.block(tile) >= 0 && stuck_at(tile);
+      }
+   }
+
+   void Game::undo_move()
+   {
+      UndoStack::Move move;
+      if (!history.undo(move))
+         return;
+
+      apply_move(move, move.to, move.from, move.facing_before);
+      pushes -= move.pushes;
+   }
+
+   void Game::redo_move()
+   {
+      UndoStack::Move move;
+      if (!history.redo(move))
+         return;
+
+      apply_move(move, move.from, move.to, move.facing_after);
+      pushes += move.pushes;
+   }
+
+   // Moves are recorded where they came to rest,
+   // so undo and redo simply put the mover back.
+   void Game::apply_move(const UndoStack::Move& move, unsigned from, unsigned to, unsigned face)
+   {
+      Pos tile_size{map.tile_width(), map.tile_height()};
+      Pos dest = slides.tile_at(to);
+
+      if (move.entity >= 0)
+      {
+         slides.move_block(slides.tile_at(from), dest);
+         entities[move.entity].surf.rect().pos = dest * tile_size;
+         entities.mark_changed(move.entity);
+      }
+      else
+         player.rect().pos = dest * tile_size;
+
+      facing = static_cast<Input>(face);
+      player.active_alt(alt_ids().facing[face]);
+
+      if (move.entity >= 0)
+         find_stuck();
+   }
+
+   // Where the motion ends is known up front, see SlideMap.
+   bool Game::tile_stepper(MotionScheduler::Motion& motion)
    {
+      auto& surf    = *motion.surf;
+      auto step_dir = motion.dir;
       surf.rect() += 2 * step_dir;
 
-      if (!player_walking)
+      if (motion.kind == MotionScheduler::Kind::Push)
       {
-         unsigned alt = stepper_cnt <= 6 ? 7 : 0;
+         unsigned alt = motion.frame <= 6 ? 7 : 0;
          player.active_alt_index(alt);
-         stepper_cnt++;
       }
+      motion.frame++;
 
       if (surf.rect().pos.x % map.tile_width() || surf.rect().pos.y % map.tile_height())
          return true;
 
-      if (is_offset_collision(surf, step_dir))
+      // Goals are checked whenever a block lines up with the grid, sliding or not.
+      if (motion.entity >= 0)
+         entities.mark_changed(motion.entity);
+
+      auto tile = tile_pos(surf);
+      is_sliding = tile != motion.dest;
+      if (is_sliding)
+         return true;
+
+      if (motion.entity >= 0 && slides.blocked(tile + step_dir))
+         play_sfx("ice_bump", 0.25);
+
+      return false;
+   }
+
+   void Game::run_motions()
+   {
+      motions.tick([this](MotionScheduler::Motion& motion) { return step_motion(motion); });
+   }
+
+   bool Game::step_motion(MotionScheduler::Motion& motion)
+   {
+      switch (motion.kind)
       {
-         is_sliding = false;
+         case MotionScheduler::Kind::Walk:
+         case MotionScheduler::Kind::Push:
+            return tile_stepper(motion);
 
-         if (&surf != &player)
-            get_sfx().play_sfx("ice_bump", 0.25);
+         case MotionScheduler::Kind::Win:
+            return win_animation_stepper();
+      }
 
-         return false;
+      return false;
+   }
+
+   void UndoStack::record(const Move& move)
+   {
+      redo_count = 0;
+      if (count == capacity)
+      {
+         first = (first + 1) % capacity;
+         count--;
       }
 
-      //cerr << "Player: " << player.rect().pos << " Surf: " << surf->rect().pos << endl; 
-      auto surface  = map.find_tile("floor", surf.rect().pos);
-      bool slippery = surface && Utils::find_or_default(surface->attr(),
-            &surf == &player ? "slippery_player" : "slippery_block", "") == "true";
+      at(count++) = move;
+   }
+
+   bool UndoStack::undo(Move& move)
+   {
+      if (!count)
+         return false;
+
+      move = at(--count);
+      redo_count++;
+      return true;
+   }
+
+   bool UndoStack::redo(Move& move)
+   {
+      if (!redo_count)
+         return false;
+
+      move = at(count++);
+      redo_count--;
+      return true;
+   }
+
+   void UndoStack::save_state(StateWriter& writer) const
+   {
+      writer.u16(count);
+      writer.u16(redo_count);
+      for (unsigned i = 0; i < count + redo_count; i++)
+      {
+         auto& move = at(i);
+         writer.u8(move.entity);
+         writer.u8(move.pushes);
+         writer.u8(move.facing_before);
+         writer.u8(move.facing_after);
+         writer.u16(move.from);
+         writer.u16(move.to);
+      }
+   }
 
-      is_sliding = slippery;
-      return slippery;
+   void UndoStack::load_state(StateReader& reader)
+   {
+      unsigned undos = reader.u16();
+      unsigned redos = reader.u16();
+      if (undos + redos > capacity)
+         throw runtime_error("Savestate has too many moves to undo.");
+
+      first = 0;
+      count = undos;
+      redo_count = redos;
+      for (unsigned i = 0; i < count + redo_count; i++)
+      {
+         auto& move = at(i);
+         move.entity        = int8_t(reader.u8());
+         move.pushes        = reader.u8();
+         move.facing_before = reader.u8();
+         move.facing_after  = reader.u8();
+         move.from          = reader.u16();
+         move.to            = reader.u16();
+
+         if (move.facing_before > static_cast<unsigned>(Input::Right) ||
+               move.facing_after > static_cast<unsigned>(Input::Right))
+            throw runtime_error("Savestate has an invalid move.");
+      }
    }
 
-   void Game::run_stepper()
+   void MotionScheduler::start(Kind kind, Surface* surf, int entity, Pos dir, Pos dest)
    {
-      if (stepper && !stepper())
-         stepper = {};
+      if (count == capacity)
+         throw logic_error("Too many motions at once.");
+
+      motions[count++] = {kind, surf, entity, dir, dest, 0};
    }
 
    CameraManager::CameraManager(RenderTarget& target, const Rect& rect, Blit::Pos map_size)
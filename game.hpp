@@ -4,12 +4,21 @@
 #include "surface.hpp"
 #include "tilemap.hpp"
 #include "font.hpp"
+#include "entity_store.hpp"
+#include "slide_map.hpp"
+#include "solver.hpp"
+#include "state_stream.hpp"
+#include "rewind_buffer.hpp"
 #include "audio/mixer.hpp"
+#include "utils.hpp"
 
+#include <array>
 #include <string>
 #include <functional>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <random>
 
 #include "libretro.h"
@@ -28,6 +37,10 @@ namespace Icy
       Push,
       Menu,
       Reset,
+      Rewind,
+      Undo,
+      Redo,
+      Hint,
       None
    };
 
@@ -35,10 +48,30 @@ namespace Icy
    {
       public:
          void add_stream(const std::string &ident, const std::string &path);
-         void play_sfx(const std::string &ident, float volume = 1.0f) const;
+
+         // Effects are queued while a frame is simulated, and reach the mixer
+         // in commit(), so frames which are run again (run-ahead) or never
+         // heard do not play anything.
+         void play_sfx(const std::string &ident, float volume = 1.0f);
+         void commit(bool audible);
 
       private:
-         std::map<std::string, std::shared_ptr<std::vector<float>>> effects;
+         struct Effect
+         {
+            const float* data;
+            std::size_t samples;
+            std::shared_ptr<const void> owner;
+         };
+         std::map<std::string, Effect> effects;
+
+         struct Queued
+         {
+            const Effect* effect;
+            float volume;
+         };
+         enum { queue_capacity = 16 };
+         std::array<Queued, queue_capacity> queue;
+         unsigned queued = 0;
    };
 
    SFXManager& get_sfx();
@@ -54,12 +87,32 @@ namespace Icy
          void init(const std::vector<Track>& tracks);
          void step(Audio::Mixer& mixer);
 
+         // Track choice is part of savestates, so replays pick the same tracks.
+         // Loading reads and checks the state first, and applies it separately,
+         // so it can wait until the rest of a savestate has loaded.
+         struct State
+         {
+            std::uint32_t rng;
+            bool first;
+            unsigned last;
+         };
+         void save_state(Blit::StateWriter& writer) const;
+         State read_state(Blit::StateReader& reader) const;
+         void load_state(const State& state);
+
+         // Track choice follows from the seed, e.g. for replays.
+         std::uint32_t seed() const { return rng; }
+         void seed(std::uint32_t seed) { rng = seed ? seed : 1; }
+
       private:
          std::shared_ptr<Audio::Stream> current;
          Audio::VorbisLoader loader;
          std::vector<Track> tracks;
          bool first = true;
          unsigned last = 0;
+
+         std::uint32_t rng = 1;
+         unsigned random(unsigned range);
    };
 
    BGManager& get_bg();
@@ -81,15 +134,108 @@ namespace Icy
       public:
          EdgeDetector(bool init);
          bool set(bool state);
+         bool state() const { return pos; }
       private:
          bool pos;
    };
 
+   // Motions and animations in flight, e.g. a sliding block or the win sequence.
+   // Records live in a fixed pool and are ticked together once per frame,
+   // so starting one never allocates, and several can run at the same time.
+   class MotionScheduler
+   {
+      public:
+         enum class Kind : unsigned
+         {
+            Walk, // Player moving one tile, and sliding on from there.
+            Push, // Pushed block sliding, while the player holds the push pose.
+            Win   // Win sequence.
+         };
+
+         struct Motion
+         {
+            Kind kind;
+            Blit::Surface* surf;
+            int entity;     // Entity ID of surf, or -1.
+            Blit::Pos dir;
+            Blit::Pos dest; // Tile where a Walk or Push comes to rest.
+            unsigned frame;
+         };
+
+         enum { capacity = 16 };
+
+         MotionScheduler() : count(0) {}
+
+         void start(Kind kind, Blit::Surface* surf = nullptr, int entity = -1,
+               Blit::Pos dir = {}, Blit::Pos dest = {});
+         void clear() { count = 0; }
+         bool active() const { return count; }
+         unsigned size() const { return count; }
+         Motion& operator[](unsigned i) { return motions[i]; }
+         const Motion& operator[](unsigned i) const { return motions[i]; }
+
+         // Steps every motion in the order they were started,
+         // and drops those for which step returns false.
+         template <typename Func>
+         void tick(Func&& step)
+         {
+            unsigned kept = 0;
+            for (unsigned i = 0; i < count; i++)
+            {
+               if (step(motions[i]))
+                  motions[kept++] = motions[i];
+            }
+            count = kept;
+         }
+
+      private:
+         std::array<Motion, capacity> motions;
+         unsigned count;
+   };
+
+   // Completed moves of the player, for undo and redo. Records live in a
+   // fixed ring, so recording never allocates, and the oldest are
+   // forgotten once it is full. Recording a move drops what could be redone.
+   class UndoStack
+   {
+      public:
+         struct Move
+         {
+            std::int8_t entity;        // Block that was pushed, or -1 for a player move.
+            std::uint8_t pushes;       // Pushes it counted for.
+            std::uint8_t facing_before;
+            std::uint8_t facing_after;
+            std::uint16_t from, to;    // Tile indices, where the mover came to rest.
+         };
+
+         enum { capacity = 256 };
+
+         UndoStack() : first(0), count(0), redo_count(0) {}
+
+         void record(const Move& move);
+         bool undo(Move& move);
+         bool redo(Move& move);
+
+         void save_state(Blit::StateWriter& writer) const;
+         void load_state(Blit::StateReader& reader);
+
+      private:
+         std::array<Move, capacity> moves;
+         unsigned first, count, redo_count;
+
+         Move& at(unsigned i) { return moves[(first + i) % capacity]; }
+         const Move& at(unsigned i) const { return moves[(first + i) % capacity]; }
+   };
+
    class Game
    {
       public:
-         Game(const std::string& level_path, unsigned chapter, unsigned level, unsigned best_pushes, Blit::FontCluster& font);
+         // headless: Only simulated, e.g. for replays. Nothing is rendered,
+         // not even on load, and no effects or hints are played.
+         Game(const std::string& level_path, unsigned chapter, unsigned level, unsigned best_pushes, Blit::FontCluster& font,
+               bool headless = false);
          Game(const std::string& level_path);
+         ~Game();
 
          void input_cb(std::function<bool (Input)> cb) { m_input_cb = cb; }
          void video_cb(std::function<void (const void*, unsigned, unsigned, std::size_t)> cb) { m_video_cb = cb; }
@@ -100,14 +246,62 @@ namespace Icy
          unsigned get_pushes() const { return pushes; }
          void set_bg(const Blit::Surface& bg);
 
-         void iterate();
+         // Frames which are not shown, e.g. run-ahead, skip rendering.
+         void iterate(bool present = true);
+         void render();
          bool won() const;
 
+         // The next frame takes input: nothing is in motion and the level is not won.
+         bool idle() const { return !motions.active() && !won_frame_cnt; }
+
+         // Where the player and blocks are, for the solver. Only meaningful while idle.
+         Puzzle puzzle() const;
+
          static const unsigned fb_width = 320;
          static const unsigned fb_height = 200;
 
+         unsigned get_chapter() const { return chapter; }
+         unsigned get_level() const { return level; }
+
+         // Savestates hold only what changes while playing,
+         // the level itself is loaded again by chapter and level.
+         enum
+         {
+            max_entities       = 64,
+            entity_state_size  = 24,
+            motion_state_size  = 23,
+            move_state_size    = 8,
+            state_size         = 64 + max_entities * entity_state_size +
+               MotionScheduler::capacity * motion_state_size +
+               UndoStack::capacity * move_state_size
+         };
+         void save_state(Blit::StateWriter& writer) const;
+         void load_state(Blit::StateReader& reader);
+
+         // Puts the blocks and the player back the way they were loaded,
+         // from a snapshot taken on load. Best pushes are progress, and are kept.
+         void reset();
+
+         void set_best_pushes(unsigned pushes) { best_pushes = pushes; }
+
       private:
          Blit::Tilemap map;
+         EntityStore entities;
+         SlideMap slides;
+
+         // Tile layers below and above the blocks, flattened once on load.
+         Blit::Surface static_below, static_above;
+         void cache_static_layers();
+         bool headless;
+
+         std::vector<Blit::Pos> goal_floor;
+         std::vector<unsigned> goal_blocks;
+         std::vector<Blit::Pos> goal_scratch;
+         void find_goals();
+
+         std::vector<std::uint8_t> pristine;
+         void take_pristine();
+
          Blit::RenderTarget target;
          Blit::Surface player;
          Blit::Pos player_off;
@@ -126,13 +320,14 @@ namespace Icy
          std::function<bool (Input)> m_input_cb;
          std::function<void (const void*, unsigned, unsigned, std::size_t)> m_video_cb;
 
-         std::function<bool ()> stepper;
-         void run_stepper();
+         // Input is only taken while nothing is in motion.
+         MotionScheduler motions;
+         void run_motions();
+         bool step_motion(MotionScheduler::Motion& motion);
 
          unsigned frame_cnt;
          bool player_walking;
          bool is_sliding;
-         unsigned stepper_cnt;
 
          void set_initial_pos(const std::string& level);
          void update_player();
@@ -142,9 +337,24 @@ namespace Icy
          void update_triggers();
          void move_if_no_collision(Input input);
          void push_block();
+         void play_sfx(const char* ident, float volume);
+
+         // Set once a push leaves the level unsolvable, so the player is
+         // offered to undo or reset. Only pushes, undo, redo and loads
+         // check it, never frames. Worked out from the blocks, so it is not
+         // part of savestates.
+         bool stuck = false;
+         bool stuck_at(Blit::Pos tile) const;
+         void find_stuck();
+
+         UndoStack history;
+         void undo_move();
+         void redo_move();
+         void apply_move(const UndoStack::Move& move, unsigned from, unsigned to, unsigned face);
          bool is_offset_collision(Blit::Surface& surf, Blit::Pos offset);
+         Blit::Pos tile_pos(const Blit::Surface& surf) const;
 
-         bool tile_stepper(Blit::Surface& surf, Blit::Pos step_dir);
+         bool tile_stepper(MotionScheduler::Motion& motion);
          bool win_animation_stepper();
 
          unsigned best_pushes;
@@ -152,14 +362,47 @@ namespace Icy
          unsigned chapter;
          unsigned level;
 
+         // Alt IDs of the player and goal block sprites.
+         struct AltIDs
+         {
+            unsigned facing[4]; // Indexed by Input::Up through Input::Right.
+            unsigned frozen, defrost1, defrost2, cheer, down;
+         };
+         static const AltIDs& alt_ids();
+
          static Blit::Pos input_to_offset(Input input);
-         std::string input_to_string(Input input);
          Input string_to_input(const std::string& dir);
 
          std::vector<std::reference_wrapper<Blit::SurfaceCluster::Elem>> get_tiles_with_attr(const std::string& layer,
                const std::string& attr, const std::string& val = "");
 
          EdgeDetector push;
+         EdgeDetector undo;
+         EdgeDetector redo;
+         EdgeDetector hint;
+
+         // The next push of a solution with the fewest pushes, worked out on
+         // a worker thread when Hint is pressed. It is shown for as long as
+         // the player and blocks stay where they were, and is not part of
+         // savestates.
+         struct Hint
+         {
+            std::shared_ptr<Solver> solver;
+            std::future<Solver::Result> job;
+            Solver::Result result;
+            std::uint64_t position = 0;
+            bool ready = false;
+            Blit::Surface ghost; // Block to push, where it comes to rest.
+            Blit::Utils::FixedString<48> message; // Built once the result is in.
+            unsigned frame = 0;
+         };
+         Hint m_hint;
+         // Enough for every shipped level from its start, in under 64 MB.
+         enum { hint_max_states = 1 << 18 };
+         std::uint64_t position_key() const;
+         void start_hint();
+         void finish_hint(Solver::Result result);
+         void render_hint();
    };
 
    class GameManager
@@ -175,9 +418,11 @@ namespace Icy
             End
          };
 
+         // headless: Simulation only. video_cb is never called.
          GameManager(const std::string& path_game,
                std::function<bool (Input)> input_cb,
-               std::function<void (const void*, unsigned, unsigned, std::size_t)> video_cb);
+               std::function<void (const void*, unsigned, unsigned, std::size_t)> video_cb,
+               bool headless = false);
 
          GameManager();
          GameManager(GameManager&&) = default;
@@ -186,18 +431,47 @@ namespace Icy
          void input_cb(std::function<bool (Input)> cb) { m_input_cb = cb; }
          void video_cb(std::function<void (const void*, unsigned, unsigned, std::size_t)> cb) { m_video_cb = cb; }
 
-         void iterate();
+         // present: Render the frame.
+         // capture: Record the frame for rewinding. Off for frames the frontend
+         // simulates ahead and throws away.
+         // A headless manager never presents.
+         void iterate(bool present = true, bool capture = true);
 
          bool done() const;
 
          void reset_level();
          void change_level(unsigned chapter, unsigned level);
+         unsigned current_chapter() const { return m_current_chap; }
          unsigned current_level() const { return m_current_level; }
+
+         // Starts level as if it was picked from the menu, with every button
+         // taken as held until it is released. A level which is already
+         // running starts over.
+         void start_level(unsigned chapter, unsigned level);
+
+         // Best pushes of every level in order, 0 if unsolved, as saved.
+         std::vector<unsigned> progress() const;
+         void restore_progress(const std::vector<unsigned>& best_pushes);
+
+         // Reads progress again from save_data(), e.g. after it was replaced.
+         void reload_progress();
+
+         // Checksum of what replays reproduce: the level being played,
+         // progress and the running Game. Menus and music are left out.
+         std::uint64_t checksum() const;
          State game_state() const { return m_game_state; }
 
+         // The level being played, if any.
+         const Game* current_game() const { return game.get(); }
+
          std::size_t save_size() const { return save.size(); }
          void* save_data() { return save.data(); }
 
+         // Savestates. The size is fixed for a given game.
+         std::size_t state_size() const;
+         void save_state(void* data, std::size_t size) const;
+         void load_state(const void* data, std::size_t size);
+
       private:
 
          class Level : public Blit::Renderable
@@ -210,6 +484,8 @@ namespace Icy
                Level(Level&&) = default;
 
                Level(const std::string& path, const Blit::Surface& bg);
+               // Without a preview, for a headless manager.
+               explicit Level(const std::string& path) : m_path(path), completion(false), best_pushes(0) {}
                const std::string& path() const { return m_path; }
 
                void set_name(const std::string& name) { m_name = name; }
@@ -222,6 +498,7 @@ namespace Icy
 
                void set_best_pushes(unsigned pushes) { if (!best_pushes || pushes < best_pushes) best_pushes = pushes; }
                unsigned get_best_pushes() const { return best_pushes; }
+               void restore_progress(bool state, unsigned pushes) { completion = state; best_pushes = pushes; }
 
             private:
                std::string m_path;
@@ -291,8 +568,29 @@ namespace Icy
 
          SaveManager save;
 
+         // Frames of the level being played, for stepping back while Rewind is held.
+         enum { rewind_capacity = 512 * 1024 };
+         Blit::RewindBuffer rewind;
+         std::vector<std::uint8_t> rewind_state;
+         void step_rewind();
+
          std::vector<Chapter> chapters;
          std::unique_ptr<Game> game;
+
+         // The level which comes after the current one is won, built on a worker
+         // thread while the current one is played. change_level() takes it if it
+         // is the one asked for, and loads synchronously otherwise.
+         struct Prefetch
+         {
+            std::future<std::unique_ptr<Game>> game;
+            unsigned chapter, level, best_pushes;
+         };
+         Prefetch prefetch;
+         void start_prefetch();
+         std::unique_ptr<Game> take_prefetch(unsigned chapter, unsigned level);
+
+         // The level, ready to play, from the prefetch if it is the one asked for.
+         std::unique_ptr<Game> load_level(unsigned chapter, unsigned level);
          std::string dir;
 
          unsigned m_current_chap;
@@ -315,12 +613,24 @@ namespace Icy
          std::function<bool (Input)> m_input_cb;
          std::function<void (const void*, unsigned, unsigned, std::size_t)> m_video_cb;
 
+         bool present;
+         bool capture;
+
+         // Simulation only: nothing is rendered or played, and images, fonts,
+         // sound effects and level previews are not loaded. For replays and tools,
+         // where a frame costs microseconds and only the checksum matters.
+         bool headless;
+         void play_sfx(const char* ident, float volume);
+
          void init_menu(const std::string& title);
          void init_menu_sprite(pugi::xml_node doc);
          void init_level(unsigned chapter, unsigned level);
          void init_sfx(pugi::xml_node doc);
          void init_bg(pugi::xml_node doc);
 
+         static const char state_magic[8];
+         static const std::uint32_t state_version = 3;
+
          Chapter load_chapter(pugi::xml_node chap_node, int chapter);
          const Level& get_selected_level() const;
 
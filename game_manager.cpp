@@ -1,9 +1,10 @@
 #include "game.hpp"
-#include "pugixml/pugixml.hpp"
+#include "xml_document.hpp"
 #include "utils.hpp"
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <assert.h>
 
 using namespace Blit;
@@ -14,27 +15,37 @@ namespace Icy
 {
    GameManager::GameManager(const string& path_game,
          function<bool (Input)> input_cb,
-         function<void (const void*, unsigned, unsigned, size_t)> video_cb)
+         function<void (const void*, unsigned, unsigned, size_t)> video_cb,
+         bool headless)
       : save(chapters), dir(Utils::basedir(path_game)),
       m_current_chap(0), m_current_level(0), m_game_state(State::Title),
-      m_input_cb(input_cb), m_video_cb(video_cb)
+      m_input_cb(input_cb), m_video_cb(video_cb), present(true), capture(true), headless(headless),
+      chap_select(0), level_select(0),
+      old_pressed_menu_left(false), old_pressed_menu_right(false), old_pressed_menu_up(false),
+      old_pressed_menu_down(false), old_pressed_menu_ok(false), old_pressed_menu(false),
+      old_pressed_reset(false), slide_cnt(0), slide_end(0)
    {
-      xml_document doc;
+      XMLDocument doc;
 
-      if (!doc.load_file(path_game.c_str()))
+      if (!doc.load(path_game))
          throw runtime_error(Utils::join("Failed to load game: ", path_game, "."));
 
-      auto font_path = Utils::join(dir, "/", doc.child("game").child("font").attribute("source").value());
-      font.add_font(font_path, {-1, 1}, Pixel::ARGB(0xff, 0xc0, 0x98, 0x00), "yellow");
-      font.add_font(font_path, { 0, 0}, Pixel::ARGB(0xff, 0xff, 0xde, 0x00), "yellow");
-      font.add_font(font_path, {-1, 1}, Pixel::ARGB(0xff, 0x73, 0x73, 0x8b), "white");
-      font.add_font(font_path, { 0, 0}, Pixel::ARGB(0xff, 0xff, 0xff, 0xff), "white");
-      font.add_font(font_path, {-1, 1}, Pixel::ARGB(0xff, 0x39, 0x5a, 0x94), "lime");
-      font.add_font(font_path, { 0, 0}, Pixel::ARGB(0xff, 0xb8, 0xe8, 0xb0), "lime");
-
-      init_menu(doc.child("game").child("title").attribute("source").value());
-      init_menu_sprite(doc);
-      init_sfx(doc);
+      if (!headless)
+      {
+         auto font_path = Utils::join(dir, "/", doc.child("game").child("font").attribute("source").value());
+         font.add_font(font_path, {-1, 1}, Pixel::ARGB(0xff, 0xc0, 0x98, 0x00), "yellow");
+         font.add_font(font_path, { 0, 0}, Pixel::ARGB(0xff, 0xff, 0xde, 0x00), "yellow");
+         font.add_font(font_path, {-1, 1}, Pixel::ARGB(0xff, 0x73, 0x73, 0x8b), "white");
+         font.add_font(font_path, { 0, 0}, Pixel::ARGB(0xff, 0xff, 0xff, 0xff), "white");
+         font.add_font(font_path, {-1, 1}, Pixel::ARGB(0xff, 0x39, 0x5a, 0x94), "lime");
+         font.add_font(font_path, { 0, 0}, Pixel::ARGB(0xff, 0xb8, 0xe8, 0xb0), "lime");
+
+         init_menu(doc.child("game").child("title").attribute("source").value());
+         init_menu_sprite(doc);
+         init_sfx(doc);
+      }
+
+      // Music state is part of savestates, so it is kept even when nothing is heard.
       init_bg(doc);
 
       for (xml_node node = doc.child("game").child("chapter"); node; node = node.next_sibling("chapter"))
@@ -46,9 +57,14 @@ namespace Icy
 
       ui_target = RenderTarget(Game::fb_width, Game::fb_height);
 
+      rewind = RewindBuffer(state_size(), rewind_capacity);
+      rewind_state.resize(state_size());
    }
 
-   GameManager::GameManager() : save(chapters), m_current_chap(0), m_current_level(0), m_game_state(State::Game) {}
+   GameManager::GameManager()
+      : save(chapters), m_current_chap(0), m_current_level(0), m_game_state(State::Game),
+      present(true), capture(true), headless(false)
+   {}
 
    void GameManager::init_menu_sprite(xml_node doc)
    {
@@ -79,14 +95,14 @@ namespace Icy
       auto sfx = doc.child("game").child("music");
       Utils::xml_node_walker walk{sfx, "bg", "source"};
       vector<BGManager::Track> tracks;
-      for (auto& val : walk)
+      for (auto val : walk)
          tracks.push_back({Utils::join(dir, "/", val), 1.0f});
 
       auto itr = begin(tracks);
       Utils::xml_node_walker walk_volume{sfx, "bg", "volume"};
-      for (auto& val : walk_volume)
+      for (auto val : walk_volume)
       {
-         itr->gain = val.empty() ? 1.0f : std::strtod(val.c_str(), nullptr);
+         itr->gain = !*val ? 1.0f : std::strtod(val, nullptr);
          ++itr;
       }
 
@@ -99,12 +115,12 @@ namespace Icy
       Utils::xml_node_walker walk{sfx, "sound", "name"};
       Utils::xml_node_walker walk_source{sfx, "sound", "source"};
 
-      vector<pair<string, string>> sfxs;
-      for (auto& val : walk)
+      vector<pair<const char*, const char*>> sfxs;
+      for (auto val : walk)
          sfxs.push_back({val, ""});
 
       auto itr = begin(sfxs);
-      for (auto& val : walk_source)
+      for (auto val : walk_source)
       {
          itr->second = val;
          ++itr;
@@ -120,11 +136,16 @@ namespace Icy
       Utils::xml_node_walker walk_name{chap, "map", "name"};
 
       vector<Level> levels;
-      for (auto& val : walk)
-         levels.push_back({Utils::join(dir, "/", val), game_bg});
+      for (auto val : walk)
+      {
+         if (headless)
+            levels.push_back(Level{Utils::join(dir, "/", val)});
+         else
+            levels.push_back({Utils::join(dir, "/", val), game_bg});
+      }
 
       auto itr = begin(levels);
-      for (auto& val : walk_name)
+      for (auto val : walk_name)
       {
          itr->set_name(val);
          ++itr;
@@ -157,23 +178,82 @@ namespace Icy
 
    void GameManager::reset_level()
    {
-      change_level(m_current_chap, m_current_level);
+      if (!game)
+         return change_level(m_current_chap, m_current_level);
+
+      game->reset();
+      rewind.clear();
    }
 
    void GameManager::change_level(unsigned chapter, unsigned level) 
    {
-      game = Utils::make_unique<Game>(
-            chapters.at(chapter).level(level).path(), 
-            chapter,
-            level,
-            chapters.at(chapter).level(level).get_best_pushes(),
-            font);
+      game = load_level(chapter, level);
+
+      m_current_chap  = chapter;
+      m_current_level = level;
+
+      rewind.clear();
+      start_prefetch();
+   }
+
+   unique_ptr<Game> GameManager::load_level(unsigned chapter, unsigned level)
+   {
+      auto game = take_prefetch(chapter, level);
+      if (!game)
+      {
+         game = Utils::make_unique<Game>(
+               chapters.at(chapter).level(level).path(), 
+               chapter,
+               level,
+               chapters.at(chapter).level(level).get_best_pushes(),
+               font, headless);
+      }
       game->input_cb(m_input_cb);
       game->video_cb(m_video_cb);
       game->set_bg(game_bg);
+      return game;
+   }
 
-      m_current_chap  = chapter;
-      m_current_level = level;
+   // Winning moves on to the next unsolved level, counting the current one as solved.
+   void GameManager::start_prefetch()
+   {
+      auto& current = chapters[m_current_chap];
+      bool completion = current.get_completion(m_current_level);
+      current.set_completion(m_current_level, true);
+
+      unsigned chapter = m_current_chap, level = m_current_level;
+      bool found = find_next_unsolved_level(chapter, level);
+      current.set_completion(m_current_level, completion);
+
+      if (!found || (prefetch.game.valid() && prefetch.chapter == chapter && prefetch.level == level))
+         return;
+
+      auto path = chapters[chapter].level(level).path();
+      auto best_pushes = chapters[chapter].level(level).get_best_pushes();
+      auto& font = this->font;
+      bool headless = this->headless;
+
+      prefetch.chapter     = chapter;
+      prefetch.level       = level;
+      prefetch.best_pushes = best_pushes;
+      prefetch.game        = async(launch::async, [=, &font]() {
+               return Utils::make_unique<Game>(path, chapter, level, best_pushes, font, headless);
+            });
+   }
+
+   unique_ptr<Game> GameManager::take_prefetch(unsigned chapter, unsigned level)
+   {
+      if (!prefetch.game.valid() || prefetch.chapter != chapter || prefetch.level != level)
+         return {};
+
+      // Best pushes are shown in game, and may have changed since, e.g. by loading a savestate.
+      if (prefetch.best_pushes != chapters[chapter].level(level).get_best_pushes())
+      {
+         prefetch.game = {};
+         return {};
+      }
+
+      return prefetch.game.get();
    }
 
    void GameManager::init_level(unsigned chapter, unsigned level)
@@ -182,6 +262,91 @@ namespace Icy
       m_game_state = State::Game;
    }
 
+   void GameManager::start_level(unsigned chapter, unsigned level)
+   {
+      if (game && m_current_chap == chapter && m_current_level == level)
+      {
+         reset_level();
+
+         // Progress may have changed since the level was loaded, e.g. by a replay.
+         game->set_best_pushes(chapters[chapter].level(level).get_best_pushes());
+      }
+      else
+         change_level(chapter, level);
+
+      m_game_state = State::Game;
+      chap_select  = chapter;
+      level_select = level;
+
+      old_pressed_menu_left  = true;
+      old_pressed_menu_right = true;
+      old_pressed_menu_up    = true;
+      old_pressed_menu_down  = true;
+      old_pressed_menu_ok    = true;
+      old_pressed_menu       = true;
+      old_pressed_reset      = true;
+   }
+
+   vector<unsigned> GameManager::progress() const
+   {
+      vector<unsigned> best_pushes;
+      for (auto& chap : chapters)
+         for (auto& level : chap.levels())
+            best_pushes.push_back(level.get_best_pushes());
+      return best_pushes;
+   }
+
+   void GameManager::restore_progress(const vector<unsigned>& best_pushes)
+   {
+      if (best_pushes.size() != total_levels())
+         throw logic_error("Progress does not match the levels of the game.");
+
+      // As when the save file is read, a level with best pushes is solved.
+      auto pushes = begin(best_pushes);
+      for (auto& chap : chapters)
+      {
+         for (auto& level : chap.levels())
+         {
+            level.restore_progress(*pushes, *pushes);
+            ++pushes;
+         }
+      }
+
+      save.serialize();
+   }
+
+   void GameManager::reload_progress()
+   {
+      for (auto& chap : chapters)
+         for (auto& level : chap.levels())
+            level.restore_progress(false, 0);
+
+      save.unserialize();
+   }
+
+   uint64_t GameManager::checksum() const
+   {
+      vector<uint8_t> state(sizeof(uint8_t) + 2 * sizeof(uint16_t) +
+            total_levels() * sizeof(uint32_t) + sizeof(uint8_t) + Game::state_size);
+
+      StateWriter writer{state.data(), state.size()};
+      writer.u8(static_cast<uint8_t>(m_game_state));
+      writer.u16(m_current_chap);
+      writer.u16(m_current_level);
+      for (auto pushes : progress())
+         writer.u32(pushes);
+      writer.boolean(static_cast<bool>(game));
+      if (game)
+         game->save_state(writer);
+      writer.pad();
+
+      // FNV-1a
+      uint64_t hash = 0xcbf29ce484222325ull;
+      for (auto byte : state)
+         hash = (hash ^ byte) * 0x100000001b3ull;
+      return hash;
+   }
+
    bool GameManager::find_next_unsolved_level(unsigned& current_chap, unsigned& current_level)
    {
       if (current_chap == chapters.size() - 1 && current_level == chapters.back().num_levels() - 1)
@@ -234,7 +399,8 @@ namespace Icy
          enter_menu();
       }
 
-      m_video_cb(target.buffer(), target.width(), target.height(), target.width() * sizeof(Pixel));
+      if (present)
+         m_video_cb(target.buffer(), target.width(), target.height(), target.width() * sizeof(Pixel));
    }
 
    void GameManager::enter_menu()
@@ -262,16 +428,16 @@ namespace Icy
             ui_target.blit(level_complete, {});
 
          font.set_id("white");
-         font.render_msg(ui_target, Utils::join(chap_select + 1,
-                  "-", level_select + 1), 240, 155, Font::RenderAlignment::Right);
+         font.render_msg(ui_target, Utils::format<16>(chap_select + 1,
+                  "-", level_select + 1).c_str(), 240, 155, Font::RenderAlignment::Right);
       }
 
       font.set_id("lime");
-      font.render_msg(ui_target, Utils::join(total_cleared_levels(),
-               "/", total_levels()), 10, 185);
+      font.render_msg(ui_target, Utils::format<24>(total_cleared_levels(),
+               "/", total_levels()).c_str(), 10, 185);
 
-      font.render_msg(ui_target, Utils::join(100 * total_cleared_levels() / total_levels(),
-               "%"), 315, 185, Font::RenderAlignment::Right);
+      font.render_msg(ui_target, Utils::format<16>(100 * total_cleared_levels() / total_levels(),
+               "%").c_str(), 315, 185, Font::RenderAlignment::Right);
    }
 
    void GameManager::step_menu_slide()
@@ -284,6 +450,9 @@ namespace Icy
          menu_slide_dir = {};
       }
 
+      if (!present)
+         return;
+
       ui_target.blit(level_select_bg, {});
 
       for (auto& chap : chapters)
@@ -309,18 +478,27 @@ namespace Icy
 
       menu_slide_dir = dir;
 
-      get_sfx().play_sfx("level_next", 0.5);
+      play_sfx("level_next", 0.5);
+   }
+
+   void GameManager::play_sfx(const char* ident, float volume)
+   {
+      if (!headless)
+         get_sfx().play_sfx(ident, volume);
    }
 
    void GameManager::step_menu()
    {
-      ui_target.blit(level_select_bg, {});
+      if (present)
+      {
+         ui_target.blit(level_select_bg, {});
 
-      for (auto& chap : chapters)
-         for (auto& preview : chap.levels())
-            preview.render(ui_target);
+         for (auto& chap : chapters)
+            for (auto& preview : chap.levels())
+               preview.render(ui_target);
 
-      menu_render_ui();
+         menu_render_ui();
+      }
 
       // Check input. Start menu slide if selecting different level.
       bool pressed_menu_left   = m_input_cb(Input::Left);
@@ -364,7 +542,7 @@ namespace Icy
                level_select = 0;
             }
             else
-               get_sfx().play_sfx("chapter_locked", 0.5);
+               play_sfx("chapter_locked", 0.5);
          }
       }
       else if (pressed_menu_up && !old_pressed_menu_up && chap_select > 0)
@@ -384,7 +562,7 @@ namespace Icy
             level_select = new_level;
          }
          else
-            get_sfx().play_sfx("chapter_locked", 0.5);
+            play_sfx("chapter_locked", 0.5);
       }
       else if (pressed_menu_ok && !old_pressed_menu_ok)
          init_level(chap_select, level_select);
@@ -398,7 +576,19 @@ namespace Icy
       old_pressed_menu_ok     = pressed_menu_ok;
       old_pressed_menu        = pressed_menu;
 
-      m_video_cb(ui_target.buffer(), ui_target.width(), ui_target.height(), ui_target.width() * sizeof(Pixel));
+      if (present)
+         m_video_cb(ui_target.buffer(), ui_target.width(), ui_target.height(), ui_target.width() * sizeof(Pixel));
+   }
+
+   // Frames which are not captured are run again by the frontend, and
+   // savestates do not cover the rewind buffer, so only captured ones step back.
+   void GameManager::step_rewind()
+   {
+      bool loaded = capture ? rewind.pop(rewind_state.data()) : rewind.peek(rewind_state.data());
+      if (loaded)
+         load_state(rewind_state.data(), rewind_state.size());
+      if (present)
+         game->render();
    }
 
    void GameManager::step_game()
@@ -406,7 +596,10 @@ namespace Icy
       if (!game)
          return;
 
-      game->iterate();
+      if (m_input_cb(Input::Rewind))
+         return step_rewind();
+
+      game->iterate(present);
 
       bool pressed_menu = m_input_cb(Input::Menu);
       bool pressed_reset = m_input_cb(Input::Reset);
@@ -456,12 +649,15 @@ namespace Icy
                enter_menu();
          }
       }
+      else if (m_game_state == State::Game && capture)
+      {
+         save_state(rewind_state.data(), rewind_state.size());
+         rewind.push(rewind_state.data());
+      }
    }
 
    void GameManager::step_end()
    {
-      ui_target.blit(end_credit_bg, {});
-
       bool pressed_menu_ok = m_input_cb(Input::Push);
       bool trigger_ok = pressed_menu_ok && !old_pressed_menu_ok;
       old_pressed_menu_ok = pressed_menu_ok;
@@ -472,13 +668,20 @@ namespace Icy
       if (trigger_ok || trigger_menu)
          enter_menu();
 
+      if (!present)
+         return;
+
+      ui_target.blit(end_credit_bg, {});
       font.set_id("white");
       font.render_msg(ui_target, "You completed all levels!\nAwesome! :D\nThanks for playing Dinothawr!", 160, 155, Font::RenderAlignment::Centered, 2);
       m_video_cb(ui_target.buffer(), ui_target.width(), ui_target.height(), ui_target.width() * sizeof(Pixel));
    }
 
-   void GameManager::iterate()
+   void GameManager::iterate(bool present, bool capture)
    {
+      this->present = present && !headless;
+      this->capture = capture;
+
       switch (m_game_state)
       {
          case State::Title: return step_title();
@@ -490,6 +693,163 @@ namespace Icy
       }
    }
 
+   const char GameManager::state_magic[8] = { 'D', 'I', 'N', 'O', 'S', 'T', 'A', 'T' };
+
+   // Header, then the manager, then progress of every level,
+   // then the running Game, if any.
+   size_t GameManager::state_size() const
+   {
+      return sizeof(state_magic) + 4 * sizeof(uint32_t) + 64 +
+         total_levels() * (sizeof(uint8_t) + sizeof(uint32_t)) + Game::state_size;
+   }
+
+   void GameManager::save_state(void* data, size_t size) const
+   {
+      if (size < state_size())
+         throw logic_error("Savestate buffer is too small.");
+
+      StateWriter writer{data, size};
+      writer.bytes(state_magic, sizeof(state_magic));
+      writer.u32(state_version);
+      writer.u32(state_size());
+      writer.u32(chapters.size());
+      writer.u32(total_levels());
+
+      writer.u8(static_cast<uint8_t>(m_game_state));
+      writer.u16(m_current_chap);
+      writer.u16(m_current_level);
+      writer.i32(chap_select);
+      writer.i32(level_select);
+      writer.boolean(old_pressed_menu_left);
+      writer.boolean(old_pressed_menu_right);
+      writer.boolean(old_pressed_menu_up);
+      writer.boolean(old_pressed_menu_down);
+      writer.boolean(old_pressed_menu_ok);
+      writer.boolean(old_pressed_menu);
+      writer.boolean(old_pressed_reset);
+      writer.pos(menu_slide_dir);
+      writer.u32(slide_cnt);
+      writer.u32(slide_end);
+      writer.pos(ui_target.camera_pos());
+      get_bg().save_state(writer);
+
+      for (auto& chap : chapters)
+      {
+         for (auto& level : chap.levels())
+         {
+            writer.boolean(level.get_completion());
+            writer.u32(level.get_best_pushes());
+         }
+      }
+
+      writer.boolean(static_cast<bool>(game));
+      if (game)
+         game->save_state(writer);
+      writer.pad();
+   }
+
+   // Everything is read and checked before any of it is applied, so a
+   // savestate which fails to load leaves the game and the save file as they were.
+   void GameManager::load_state(const void* data, size_t size)
+   {
+      StateReader reader{data, size};
+
+      char magic[sizeof(state_magic)];
+      reader.bytes(magic, sizeof(magic));
+      if (memcmp(magic, state_magic, sizeof(magic)) || reader.u32() != state_version)
+         throw runtime_error("Savestate has invalid header.");
+
+      if (reader.u32() != state_size() || reader.u32() != chapters.size() || reader.u32() != total_levels())
+         throw runtime_error("Savestate is for a different game.");
+
+      unsigned state = reader.u8();
+      if (state > static_cast<unsigned>(State::End))
+         throw runtime_error("Savestate has invalid game state.");
+
+      unsigned chap  = reader.u16();
+      unsigned level = reader.u16();
+      if (chap >= chapters.size() || level >= chapters[chap].num_levels())
+         throw runtime_error("Savestate refers to a level which does not exist.");
+
+      int loaded_chap_select  = reader.i32();
+      int loaded_level_select = reader.i32();
+      bool menu_left          = reader.boolean();
+      bool menu_right         = reader.boolean();
+      bool menu_up            = reader.boolean();
+      bool menu_down          = reader.boolean();
+      bool menu_ok            = reader.boolean();
+      bool menu               = reader.boolean();
+      bool reset              = reader.boolean();
+      Pos slide_dir           = reader.pos();
+      unsigned loaded_slide_cnt = reader.u32();
+      unsigned loaded_slide_end = reader.u32();
+      Pos camera              = reader.pos();
+      auto bg_state           = get_bg().read_state(reader);
+
+      vector<pair<bool, unsigned>> levels(total_levels());
+      for (auto& saved : levels)
+      {
+         saved.first  = reader.boolean();
+         saved.second = reader.u32();
+      }
+
+      // Only mutable state is in the savestate. The level is reused if it is the
+      // one already running, and loaded again from its path otherwise. Game
+      // loads are all or nothing, and are the last thing here that can fail.
+      bool has_game = reader.boolean();
+      unique_ptr<Game> loaded;
+      if (has_game && game && game->get_chapter() == chap && game->get_level() == level)
+         game->load_state(reader);
+      else if (has_game)
+      {
+         loaded = load_level(chap, level);
+         loaded->load_state(reader);
+      }
+
+      m_game_state           = static_cast<State>(state);
+      chap_select            = loaded_chap_select;
+      level_select           = loaded_level_select;
+      old_pressed_menu_left  = menu_left;
+      old_pressed_menu_right = menu_right;
+      old_pressed_menu_up    = menu_up;
+      old_pressed_menu_down  = menu_down;
+      old_pressed_menu_ok    = menu_ok;
+      old_pressed_menu       = menu;
+      old_pressed_reset      = reset;
+      menu_slide_dir         = slide_dir;
+      slide_cnt              = loaded_slide_cnt;
+      slide_end              = loaded_slide_end;
+      ui_target.camera_set(camera);
+      get_bg().load_state(bg_state);
+
+      bool progress_changed = false;
+      auto saved = begin(levels);
+      for (auto& chap : chapters)
+      {
+         for (auto& level : chap.levels())
+         {
+            progress_changed |= saved->first != level.get_completion() || saved->second != level.get_best_pushes();
+            level.restore_progress(saved->first, saved->second);
+            ++saved;
+         }
+      }
+
+      if (progress_changed)
+         save.serialize();
+
+      m_current_chap  = chap;
+      m_current_level = level;
+
+      if (loaded)
+      {
+         game = move(loaded);
+         rewind.clear();
+         start_prefetch();
+      }
+      else if (!has_game)
+         game.reset();
+   }
+
    bool GameManager::done() const
    {
       return false;
@@ -574,10 +934,9 @@ namespace Icy
       string full_pushes;
       for (auto& chap : chaps)
       {
-         string pushes;
          for (auto& level : chap.levels())
-            pushes += Utils::join(level.get_best_pushes(), ",");
-         full_pushes += pushes + '\n';
+            Utils::append_all(full_pushes, level.get_best_pushes(), ',');
+         full_pushes += '\n';
       }
 
       fill(begin(save_data), end(save_data), '\0');
@@ -8,7 +8,16 @@
 
 #include "game.hpp"
 #include "utils.hpp"
+#include "asset_pack.hpp"
+#include "atlas.hpp"
 #include "audio/mixer.hpp"
+#include "state_stream.hpp"
+#include "replay.hpp"
+
+// Newer frontends tell us which frames are seen and heard, e.g. for run-ahead.
+#ifndef RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE
+#define RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE (47 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+#endif
 
 using namespace Blit::Utils;
 using namespace Icy;
@@ -21,6 +30,8 @@ static string game_path_dir;
 static Audio::Mixer mixer;
 static SFXManager sfx;
 static BGManager bg_music;
+static Blit::AssetPack asset_pack;
+static Blit::Atlas atlas;
 
 static bool use_audio_cb;
 static bool use_frame_time_cb;
@@ -37,7 +48,31 @@ static retro_input_state_t input_state_cb;
 static retro_usec_t frame_time;
 static retro_usec_t time_reference;
 static retro_usec_t total_time;
-static bool present_frame;
+
+// Buttons held in the frame being run, bit n for Input n.
+// Read once per retro_run(), or taken from a replay.
+static uint16_t input_mask;
+static_assert(static_cast<unsigned>(Input::None) <= 16, "Inputs do not fit the input mask.");
+
+// Replays, see replay.hpp. Recording restarts the level being played and
+// goes on from there, playback starts with the first frame after loading.
+// The replay is kept next to the game file.
+struct ReplaySession
+{
+   enum class Mode { Disabled, Record, Play };
+   Mode mode = Mode::Disabled;
+
+   Replay replay;
+   bool active = false;   // Recording or playing right now.
+   bool played = false;   // Playback is only done once per load.
+   bool diverged = false;
+   unsigned frame = 0;    // Frames recorded or played so far.
+
+   // Playback runs on the progress of the recording. The player's own
+   // save RAM is put back when it ends.
+   vector<uint8_t> save_ram;
+};
+static ReplaySession replay_session;
 
 namespace Icy
 {
@@ -47,6 +82,12 @@ namespace Icy
    BGManager& get_bg() { return bg_music; }
 }
 
+namespace Blit
+{
+   AssetPack& get_asset_pack() { return asset_pack; }
+   Atlas& get_atlas() { return atlas; }
+}
+
 #define AUDIO_FRAMES (44100 / 60)
 static int16_t audio_buffer[2 * AUDIO_FRAMES];
 
@@ -93,6 +134,7 @@ void retro_set_environment(retro_environment_t cb)
    environ_cb = cb;
    retro_variable vars[] = {
       { "dino_timer", "Timer as FPS reference; enabled|disabled" },
+      { "dino_replay", "Input replay; disabled|record|play" },
       { nullptr, nullptr },
    };
    cb(RETRO_ENVIRONMENT_SET_VARIABLES, vars);
@@ -143,6 +185,169 @@ static void frame_time_cb(retro_usec_t usec)
    frame_time = usec;
 }
 
+// Path of a file next to the game file, e.g. dinothawr.pack for dinothawr.game.
+static string game_sibling(const char* ext)
+{
+   auto dot = game_path.find_last_of('.');
+   auto sep = game_path.find_last_of("/\\");
+   if (dot == string::npos || (sep != string::npos && dot < sep))
+      dot = game_path.size();
+
+   return join(game_path.substr(0, dot), ext);
+}
+
+static unsigned joypad_button(Input input)
+{
+   switch (input)
+   {
+      case Input::Up:     return RETRO_DEVICE_ID_JOYPAD_UP;
+      case Input::Down:   return RETRO_DEVICE_ID_JOYPAD_DOWN;
+      case Input::Left:   return RETRO_DEVICE_ID_JOYPAD_LEFT;
+      case Input::Right:  return RETRO_DEVICE_ID_JOYPAD_RIGHT;
+      case Input::Push:   return RETRO_DEVICE_ID_JOYPAD_B;
+      case Input::Menu:   return RETRO_DEVICE_ID_JOYPAD_A;
+      case Input::Reset:  return RETRO_DEVICE_ID_JOYPAD_X;
+      case Input::Rewind: return RETRO_DEVICE_ID_JOYPAD_L2;
+      case Input::Undo:   return RETRO_DEVICE_ID_JOYPAD_L;
+      case Input::Redo:   return RETRO_DEVICE_ID_JOYPAD_R;
+      case Input::Hint:   return RETRO_DEVICE_ID_JOYPAD_SELECT;
+      default: throw logic_error("Input has no button.");
+   }
+}
+
+static uint16_t read_input()
+{
+   uint16_t mask = 0;
+   for (unsigned i = 0; i < static_cast<unsigned>(Input::None); i++)
+      if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, joypad_button(static_cast<Input>(i))))
+         mask |= 1 << i;
+   return mask;
+}
+
+static void end_replay()
+{
+   auto& session = replay_session;
+   if (!session.active)
+      return;
+   session.active = false;
+
+   if (session.mode == ReplaySession::Mode::Record)
+   {
+      auto path = game_sibling(".replay");
+      try
+      {
+         session.replay.save(path);
+         if (log_cb)
+            log_cb(RETRO_LOG_INFO, "Dinothawr: Recorded %u frames to %s\n", session.replay.frames(), path.c_str());
+      }
+      catch (const exception& e)
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_ERROR, "Dinothawr: %s\n", e.what());
+      }
+   }
+   else
+   {
+      copy(begin(session.save_ram), end(session.save_ram), static_cast<uint8_t*>(game->save_data()));
+      game->reload_progress();
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Dinothawr: Replay ended after %u frames%s.\n",
+               session.frame, session.diverged ? ", and diverged" : "");
+   }
+}
+
+// Starts recording or playback when it is due, before the frames of a retro_run().
+static void update_replay()
+{
+   auto& session = replay_session;
+   if (session.active)
+      return;
+
+   if (session.mode == ReplaySession::Mode::Record && game->game_state() == GameManager::State::Game)
+   {
+      game->start_level(game->current_chapter(), game->current_level());
+      session.replay = Replay(*game);
+      session.active = true;
+      session.frame = 0;
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "Dinothawr: Recording replay from level %u-%u.\n",
+               game->current_chapter() + 1, game->current_level() + 1);
+   }
+   else if (session.mode == ReplaySession::Mode::Play && !session.played)
+   {
+      session.played = true;
+
+      auto save_ram = static_cast<const uint8_t*>(game->save_data());
+      session.save_ram.assign(save_ram, save_ram + game->save_size());
+      session.active = true;
+      session.diverged = false;
+      session.frame = 0;
+
+      try
+      {
+         session.replay = Replay::load(game_sibling(".replay"));
+         session.replay.start(*game);
+      }
+      catch (const exception& e)
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_ERROR, "Dinothawr: %s\n", e.what());
+         session.replay = Replay();
+      }
+
+      if (!session.replay.frames())
+         end_replay();
+   }
+}
+
+static void update_replay_mode()
+{
+   auto mode = ReplaySession::Mode::Disabled;
+   retro_variable var = { "dino_replay" };
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "record"))
+         mode = ReplaySession::Mode::Record;
+      else if (!strcmp(var.value, "play"))
+         mode = ReplaySession::Mode::Play;
+   }
+
+   if (mode != replay_session.mode)
+      end_replay();
+   replay_session.mode = mode;
+}
+
+static void run_frame(bool video, bool audio, uint16_t live_input)
+{
+   auto& session = replay_session;
+   bool playing = session.active && session.mode == ReplaySession::Mode::Play;
+   input_mask = playing ? session.replay.input(session.frame) : live_input;
+
+   game->iterate(video, audio);
+
+   if (!session.active)
+      return;
+
+   if (playing)
+   {
+      if (!session.diverged && !session.replay.verify(session.frame, *game))
+      {
+         session.diverged = true;
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "Dinothawr: Replay diverged by frame %u.\n", session.frame);
+      }
+
+      if (++session.frame >= session.replay.frames())
+         end_replay();
+   }
+   else
+   {
+      session.replay.record(input_mask, *game);
+      session.frame++;
+   }
+}
+
 static void update_variables()
 {
    retro_variable var = { "dino_timer" };
@@ -156,6 +361,8 @@ static void update_variables()
       if (log_cb)
          log_cb(RETRO_LOG_INFO, "Dinothawr: ", "Using timer as FPS reference: %s.\n", option_use_frame_time ? "enabled" : "disabled");
    }
+
+   update_replay_mode();
 }
 
 static void check_variables()
@@ -172,6 +379,8 @@ void retro_run(void)
       frame_time = time_reference;
 
    input_poll_cb();
+   uint16_t live_input = read_input();
+   update_replay();
 
    if (frame_time < (time_reference >> 1))
       total_time += frame_time;
@@ -179,56 +388,65 @@ void retro_run(void)
       total_time += ((frame_time + (time_reference >> 1)) / time_reference) * time_reference;
    int frames = (total_time + (time_reference >> 1)) / time_reference;
 
+   // Bit 0 is video, bit 1 is audio. Frames run ahead are not heard,
+   // and are thrown away by the frontend, so they are not recorded for rewind either.
+   int av_enable = 3;
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+      av_enable = 3;
+   bool video = av_enable & 1;
+   bool audio = av_enable & 2;
+
    if (frames <= 0)
       video_cb(nullptr, Game::fb_width, Game::fb_height, 0);
    else
    {
-      present_frame = false;
       for (int i = 0; i < frames - 1; i++)
-         game->iterate();
-      present_frame = true;
-      game->iterate();
+         run_frame(false, audio, live_input);
+      run_frame(video, audio, live_input);
       total_time -= time_reference * frames;
    }
 
-   get_bg().step(mixer);
+   get_sfx().commit(audio);
+   if (audio)
+      get_bg().step(mixer);
 
-   if (!use_audio_cb)
+   if (!use_audio_cb && audio)
       audio_callback();
 
    if (game->done())
       environ_cb(RETRO_ENVIRONMENT_SHUTDOWN, nullptr);
 }
 
-static void load_game(const string& path)
+// dinothawr.game looks for a pre-built dinothawr.pack next to it.
+// If there is none, every asset is loaded from loose files instead.
+static void open_asset_pack(const string& path)
 {
-   auto input_cb = [&](Input input) -> bool {
-      unsigned btn;
-      switch (input)
-      {
-         case Input::Up:    btn = RETRO_DEVICE_ID_JOYPAD_UP; break;
-         case Input::Down:  btn = RETRO_DEVICE_ID_JOYPAD_DOWN; break;
-         case Input::Left:  btn = RETRO_DEVICE_ID_JOYPAD_LEFT; break;
-         case Input::Right: btn = RETRO_DEVICE_ID_JOYPAD_RIGHT; break;
-         case Input::Push:  btn = RETRO_DEVICE_ID_JOYPAD_B; break;
-         case Input::Menu:  btn = RETRO_DEVICE_ID_JOYPAD_A; break;
-         case Input::Reset: btn = RETRO_DEVICE_ID_JOYPAD_X; break;
-         default: return false;
-      }
+   auto pack_path = game_sibling(".pack");
+   bool opened = asset_pack.open(pack_path, basedir(path));
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "Dinothawr: %s asset pack: %s\n",
+            opened ? "Using" : "Not using", pack_path.c_str());
+}
 
-      return input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, btn);
+static void load_game(const string& path)
+{
+   auto input_cb = [](Input input) -> bool {
+      return input < Input::None && ((input_mask >> static_cast<unsigned>(input)) & 1);
    };
 
    game = make_unique<GameManager>(path, input_cb,
          [&](const void* data, unsigned width, unsigned height, size_t pitch) {
-            if (present_frame)
-               video_cb(data, width, height, pitch);
+            video_cb(data, width, height, pitch);
          }
    );
+   get_sfx().commit(false);
 }
 
 void retro_reset(void)
 {
+   end_replay();
+
    size_t memory_size = retro_get_memory_size(RETRO_MEMORY_SAVE_RAM);
    vector<uint8_t> data(memory_size);
    uint8_t *game_data = reinterpret_cast<uint8_t*>(retro_get_memory_data(RETRO_MEMORY_SAVE_RAM));
@@ -246,12 +464,14 @@ bool retro_load_game(const struct retro_game_info* info)
       use_audio_cb = environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK, &cb);
 
       time_reference = 1000000 / 60;
-      present_frame = false;
       struct retro_frame_time_callback frame_cb = { frame_time_cb, time_reference };
       use_frame_time_cb = environ_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_cb);
 
+      replay_session = ReplaySession();
+
       game_path = info->path;
       game_path_dir = basedir(game_path);
+      open_asset_pack(game_path);
       load_game(game_path);
       mixer = Audio::Mixer();
 
@@ -275,7 +495,10 @@ bool retro_load_game_special(unsigned, const struct retro_game_info*, size_t)
 
 void retro_unload_game(void)
 {
+   end_replay();
    game.reset();
+   atlas.clear();
+   asset_pack.close();
 }
 
 unsigned retro_get_region(void)
@@ -283,19 +506,89 @@ unsigned retro_get_region(void)
    return RETRO_REGION_NTSC;
 }
 
+// The frame timer is saved after the game, so a replayed
+// retro_run() steps the same number of frames. Then comes the frame of
+// the replay being recorded or played, plus one, or 0 if there is none.
 size_t retro_serialize_size(void)
 {
-   return 0;
+   return game ? game->state_size() + 3 * sizeof(uint32_t) : 0;
 }
 
-bool retro_serialize(void*, size_t)
+bool retro_serialize(void* data, size_t size)
 {
-   return false;
+   if (!game)
+      return false;
+
+   try
+   {
+      if (size < retro_serialize_size())
+         return false;
+
+      size_t state_size = game->state_size();
+      game->save_state(data, state_size);
+
+      Blit::StateWriter writer{static_cast<uint8_t*>(data) + state_size, size - state_size};
+      writer.u32(uint32_t(total_time));
+      writer.u32(uint32_t(uint64_t(total_time) >> 32));
+      writer.u32(replay_session.active ? replay_session.frame + 1 : 0);
+      writer.pad();
+      return true;
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << endl;
+      return false;
+   }
 }
 
-bool retro_unserialize(const void*, size_t)
+bool retro_unserialize(const void* data, size_t size)
 {
-   return false;
+   if (!game)
+      return false;
+
+   try
+   {
+      if (size < retro_serialize_size())
+         return false;
+
+      size_t state_size = game->state_size();
+      game->load_state(data, state_size);
+
+      Blit::StateReader reader{static_cast<const uint8_t*>(data) + state_size, size - state_size};
+      uint64_t low = reader.u32();
+      uint64_t high = reader.u32();
+      total_time = low | (high << 32);
+
+      // Loading an older state while recording takes back the frames after
+      // it. A state from before the recording started, e.g. one run-ahead
+      // loads, drops it, and recording starts over with the next frame.
+      // Playback goes on from the frame of the state, if it has one.
+      unsigned frame = reader.u32();
+      auto& session = replay_session;
+      if (session.active && session.mode == ReplaySession::Mode::Record)
+      {
+         if (frame && frame - 1 <= session.frame)
+         {
+            session.frame = frame - 1;
+            session.replay.truncate(session.frame);
+         }
+         else
+            session.active = false;
+      }
+      else if (session.active)
+      {
+         if (frame && frame - 1 < session.replay.frames())
+            session.frame = frame - 1;
+         else
+            end_replay();
+      }
+      return true;
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << endl;
+      return false;
+   }
 }
 
 void* retro_get_memory_data(unsigned id)
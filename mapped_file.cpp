@@ -0,0 +1,81 @@
+#include "mapped_file.hpp"
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace Blit
+{
+   MappedFile::MappedFile()
+      : m_data(nullptr), m_size(0), m_mapped(false), m_writable(false)
+   {}
+
+   MappedFile::~MappedFile()
+   {
+#ifndef _WIN32
+      if (m_mapped)
+         munmap(m_data, m_size);
+#endif
+   }
+
+   shared_ptr<MappedFile> MappedFile::open(const string& path, bool writable)
+   {
+      shared_ptr<MappedFile> file{new MappedFile};
+      file->m_writable = writable;
+
+#ifndef _WIN32
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+         return {};
+
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0)
+      {
+         void *ptr = writable ?
+            mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+            mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+         if (ptr != MAP_FAILED)
+         {
+            file->m_data   = static_cast<uint8_t*>(ptr);
+            file->m_size   = st.st_size;
+            file->m_mapped = true;
+         }
+      }
+
+      ::close(fd);
+      if (file->m_mapped)
+         return file;
+#endif
+
+      FILE *f = fopen(path.c_str(), "rb");
+      if (!f)
+         return {};
+
+      fseek(f, 0, SEEK_END);
+      long len = ftell(f);
+      rewind(f);
+
+      if (len > 0)
+      {
+         file->m_buffer.resize(len);
+         if (fread(file->m_buffer.data(), 1, len, f) != static_cast<size_t>(len))
+         {
+            fclose(f);
+            return {};
+         }
+      }
+
+      fclose(f);
+      file->m_data = file->m_buffer.data();
+      file->m_size = file->m_buffer.size();
+      return file;
+   }
+}
+
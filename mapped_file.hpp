@@ -0,0 +1,40 @@
+#ifndef MAPPED_FILE_HPP__
+#define MAPPED_FILE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Blit
+{
+   // View of a whole file. Backed by mmap() where available,
+   // and falls back to reading the file into memory elsewhere.
+   // A writable view is private to us, writes never reach the file.
+   class MappedFile
+   {
+      public:
+         static std::shared_ptr<MappedFile> open(const std::string& path, bool writable = false);
+         ~MappedFile();
+
+         MappedFile(const MappedFile&) = delete;
+         MappedFile& operator=(const MappedFile&) = delete;
+
+         const std::uint8_t* data() const { return m_data; }
+         std::uint8_t* mutable_data() { return m_writable ? m_data : nullptr; }
+         std::size_t size() const { return m_size; }
+
+      private:
+         MappedFile();
+
+         std::uint8_t* m_data;
+         std::size_t m_size;
+         bool m_mapped;
+         bool m_writable;
+         std::vector<std::uint8_t> m_buffer;
+   };
+}
+
+#endif
+
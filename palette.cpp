@@ -0,0 +1,52 @@
+#include "palette.hpp"
+
+using namespace std;
+
+namespace Blit
+{
+   bool index_pixels(const Pixel* pixels, size_t count,
+         Palette& palette, vector<uint8_t>& indices)
+   {
+      palette.fill(Pixel());
+      indices.resize(count);
+
+      // Open addressing from color to palette entry, with room to spare.
+      array<int16_t, 512> table;
+      table.fill(-1);
+      unsigned colors = 1;
+
+      for (size_t i = 0; i < count; i++)
+      {
+         Pixel pix = pixels[i];
+         if (!(pix.pixel & Pixel::alpha_mask))
+         {
+            indices[i] = 0;
+            continue;
+         }
+
+         unsigned slot = (pix.pixel * 2654435761u) >> 23;
+         while (table[slot] >= 0 && palette[table[slot]].pixel != pix.pixel)
+            slot = (slot + 1) & (table.size() - 1);
+
+         if (table[slot] < 0)
+         {
+            if (colors == palette.size())
+               return false;
+
+            table[slot] = colors;
+            palette[colors++] = pix;
+         }
+
+         indices[i] = table[slot];
+      }
+
+      return true;
+   }
+
+   void refill_palette(Palette& palette, Pixel pix)
+   {
+      for (auto& color : palette)
+         color = color.pixel & Pixel::alpha_mask ? pix : Pixel();
+   }
+}
+
@@ -0,0 +1,27 @@
+#ifndef PALETTE_HPP__
+#define PALETTE_HPP__
+
+#include "blit.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Blit
+{
+   // Colors of an indexed surface. Entry 0 is always transparent,
+   // and so is any other entry without alpha.
+   typedef std::array<Pixel, 256> Palette;
+
+   // Converts pixels to indices into palette. All transparent pixels map to entry 0.
+   // Returns false if there are more than 255 opaque colors.
+   bool index_pixels(const Pixel* pixels, std::size_t count,
+         Palette& palette, std::vector<std::uint8_t>& indices);
+
+   // Replaces every opaque color in palette with pix.
+   void refill_palette(Palette& palette, Pixel pix);
+}
+
+#endif
+
@@ -56,12 +56,9 @@ namespace Blit
       blit_offset(surf, subrect, {0, 0});
    }
 
-   void RenderTarget::blit_offset(const Surface& surf_, Rect subrect, Pos pos)
+   void RenderTarget::blit_offset(const Surface& surf, Rect subrect, Pos pos)
    {
-      Surface surf{surf_};
-      surf.rect() += pos;
-
-      Rect surf_rect = surf.rect();
+      Rect surf_rect = surf.rect() + pos;
       Rect dest_rect = rect;
 
       bool ignore_camera = surf.ignore_camera();
@@ -72,19 +69,29 @@ namespace Blit
 
       if (subrect)
       {
-         subrect += surf.rect().pos;
+         subrect += surf_rect.pos;
          blit_rect &= subrect;
       }
 
       if (!blit_rect)
          return;
 
-      auto src_data = surf.pixel_raw(blit_rect.pos);
+      int src_stride = surf.stride();
       auto dst_data = ignore_camera ?
          pixel_raw_no_offset(blit_rect.pos) : pixel_raw(blit_rect.pos);
 
-      for (int y = 0; y < blit_rect.h; y++, src_data += surf_rect.w, dst_data += rect.w)
-         Pixel::set_line_if_alpha(dst_data, src_data, blit_rect.w);
+      if (auto palette = surf.palette().get())
+      {
+         auto src_data = surf.index_raw(blit_rect.pos - pos);
+         for (int y = 0; y < blit_rect.h; y++, src_data += src_stride, dst_data += rect.w)
+            Pixel::set_line_if_alpha_indexed(dst_data, src_data, palette->data(), blit_rect.w);
+      }
+      else
+      {
+         auto src_data = surf.pixel_raw(blit_rect.pos - pos);
+         for (int y = 0; y < blit_rect.h; y++, src_data += src_stride, dst_data += rect.w)
+            Pixel::set_line_if_alpha(dst_data, src_data, blit_rect.w);
+      }
    }
 
    Pixel* RenderTarget::pixel_raw_no_offset(Pos pos)
@@ -0,0 +1,184 @@
+#include "replay.hpp"
+#include "mapped_file.hpp"
+#include "state_stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace Blit;
+using namespace std;
+
+namespace Icy
+{
+   const char Replay::magic[8] = { 'D', 'I', 'N', 'O', 'R', 'E', 'P', 'L' };
+
+   Replay::Replay(const GameManager& game, unsigned checksum_interval)
+      : chapter(game.current_chapter()), level(game.current_level()),
+      seed(get_bg().seed()), progress(game.progress()),
+      checksum_interval(max(checksum_interval, 1u))
+   {}
+
+   Replay Replay::load(const string& path)
+   {
+      auto file = MappedFile::open(path);
+      if (!file)
+         throw runtime_error(Utils::join("Failed to open replay: ", path));
+
+      try
+      {
+         StateReader reader{file->data(), file->size()};
+
+         // Counts are checked against the file, so a corrupt one cannot allocate much.
+         auto count = [&reader, &file]() -> unsigned {
+            unsigned count = reader.u32();
+            if (count > file->size())
+               throw runtime_error("Count is larger than the file.");
+            return count;
+         };
+
+         char header[sizeof(magic)];
+         reader.bytes(header, sizeof(header));
+         if (memcmp(header, magic, sizeof(magic)) || reader.u32() != version)
+            throw runtime_error("Header is invalid.");
+
+         Replay replay;
+         replay.chapter = reader.u16();
+         replay.level   = reader.u16();
+         replay.seed    = reader.u32();
+
+         replay.progress.resize(count());
+         for (auto& pushes : replay.progress)
+            pushes = reader.u32();
+
+         replay.m_frames = reader.u32();
+         replay.checksum_interval = reader.u32();
+         if (!replay.checksum_interval)
+            throw runtime_error("Checksum interval is 0.");
+
+         unsigned start = 0;
+         replay.runs.resize(count());
+         for (auto& run : replay.runs)
+         {
+            unsigned len = reader.u32();
+            if (!len || len > replay.m_frames - start)
+               throw runtime_error("Input runs do not add up to the frames.");
+
+            run.start = start;
+            run.input = reader.u16();
+            start += len;
+         }
+         if (start != replay.m_frames)
+            throw runtime_error("Input runs do not add up to the frames.");
+
+         replay.checksums.resize(count());
+         if (replay.checksums.size() > replay.m_frames / replay.checksum_interval)
+            throw runtime_error("There are more checksums than frames.");
+         for (auto& checksum : replay.checksums)
+         {
+            uint64_t low = reader.u32();
+            uint64_t high = reader.u32();
+            checksum = low | (high << 32);
+         }
+
+         return replay;
+      }
+      catch (const runtime_error& e)
+      {
+         throw runtime_error(Utils::join("Invalid replay ", path, ": ", e.what()));
+      }
+   }
+
+   void Replay::save(const string& path) const
+   {
+      vector<uint8_t> data(sizeof(magic) + 6 * sizeof(uint32_t) + 2 * sizeof(uint16_t) +
+            progress.size() * sizeof(uint32_t) +
+            runs.size() * (sizeof(uint32_t) + sizeof(uint16_t)) +
+            sizeof(uint32_t) + checksums.size() * sizeof(uint64_t));
+
+      StateWriter writer{data.data(), data.size()};
+      writer.bytes(magic, sizeof(magic));
+      writer.u32(version);
+      writer.u16(chapter);
+      writer.u16(level);
+      writer.u32(seed);
+
+      writer.u32(progress.size());
+      for (auto pushes : progress)
+         writer.u32(pushes);
+
+      writer.u32(m_frames);
+      writer.u32(checksum_interval);
+
+      writer.u32(runs.size());
+      for (unsigned i = 0; i < runs.size(); i++)
+      {
+         unsigned end = i + 1 < runs.size() ? runs[i + 1].start : m_frames;
+         writer.u32(end - runs[i].start);
+         writer.u16(runs[i].input);
+      }
+
+      writer.u32(checksums.size());
+      for (auto checksum : checksums)
+      {
+         writer.u32(uint32_t(checksum));
+         writer.u32(uint32_t(checksum >> 32));
+      }
+
+      ofstream file(path, ios::binary);
+      if (!file.write(reinterpret_cast<const char*>(data.data()), data.size()))
+         throw runtime_error(Utils::join("Failed to write replay: ", path));
+   }
+
+   void Replay::start(GameManager& game) const
+   {
+      if (progress.size() != game.progress().size())
+         throw runtime_error("Replay is for a different game.");
+
+      game.restore_progress(progress);
+      get_bg().seed(seed);
+      game.start_level(chapter, level);
+   }
+
+   void Replay::record(uint16_t input, const GameManager& game)
+   {
+      if (runs.empty() || runs.back().input != input)
+         runs.push_back({m_frames, input});
+
+      m_frames++;
+      if (m_frames % checksum_interval == 0)
+         checksums.push_back(game.checksum());
+   }
+
+   void Replay::truncate(unsigned frame)
+   {
+      if (frame >= m_frames)
+         return;
+
+      m_frames = frame;
+      while (!runs.empty() && runs.back().start >= frame)
+         runs.pop_back();
+      checksums.resize(frame / checksum_interval);
+   }
+
+   uint16_t Replay::input(unsigned frame) const
+   {
+      if (frame >= m_frames)
+         return 0;
+
+      auto run = upper_bound(begin(runs), end(runs), frame,
+            [](unsigned frame, const Run& run) { return frame < run.start; });
+      return prev(run)->input;
+   }
+
+   bool Replay::verify(unsigned frame, const GameManager& game) const
+   {
+      unsigned count = frame + 1;
+      if (count % checksum_interval || count / checksum_interval > checksums.size())
+         return true;
+
+      return checksums[count / checksum_interval - 1] == game.checksum();
+   }
+}
+
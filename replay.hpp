@@ -0,0 +1,81 @@
+#ifndef REPLAY_HPP__
+#define REPLAY_HPP__
+
+#include "game.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Icy
+{
+   // The input of a session, for playing it back exactly, e.g. to reproduce
+   // a bug or to time the same frames again. A replay starts at the beginning
+   // of a level, see GameManager::start_level(), with the progress of every
+   // level and the seed of the music as they were when it was recorded.
+   //
+   // Every frame has an input mask, with bit n set while Input n is held.
+   // Consecutive frames with the same mask are stored as one run. Every
+   // checksum_interval frames the game is checksummed, see
+   // GameManager::checksum(), so playback can tell where it diverged.
+   //
+   // File layout, little-endian:
+   //    "DINOREPL", u32 version
+   //    u16 chapter, u16 level, u32 seed
+   //    u32 level count, then u32 best pushes per level
+   //    u32 frames, u32 checksum interval
+   //    u32 run count, then per run: u32 frames, u16 input mask
+   //    u32 checksum count, then u64 checksums
+   class Replay
+   {
+      public:
+         Replay() = default;
+
+         // Starts recording game, which has just started a level.
+         explicit Replay(const GameManager& game, unsigned checksum_interval = 60);
+
+         // Loads a recording. Throws runtime_error if it is invalid.
+         static Replay load(const std::string& path);
+         void save(const std::string& path) const;
+
+         // Puts game where the recording started.
+         void start(GameManager& game) const;
+
+         unsigned frames() const { return m_frames; }
+
+         // Adds frame frames(), run with input, after game has run it.
+         void record(std::uint16_t input, const GameManager& game);
+
+         // Forgets frame and everything after it, e.g. when an older
+         // savestate is loaded while recording.
+         void truncate(unsigned frame);
+
+         std::uint16_t input(unsigned frame) const;
+
+         // After game has run frame, checks it against the recording.
+         // Frames without a checksum always pass.
+         bool verify(unsigned frame, const GameManager& game) const;
+
+      private:
+         unsigned chapter = 0, level = 0;
+         std::uint32_t seed = 0;
+         std::vector<unsigned> progress;
+
+         unsigned m_frames = 0;
+         unsigned checksum_interval = 60;
+
+         struct Run
+         {
+            unsigned start; // First frame of the run.
+            std::uint16_t input;
+         };
+         std::vector<Run> runs;
+         std::vector<std::uint64_t> checksums;
+
+         static const char magic[8];
+         static const std::uint32_t version = 1;
+   };
+}
+
+#endif
+
@@ -0,0 +1,178 @@
+#include "rewind_buffer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Blit
+{
+   RewindBuffer::RewindBuffer(size_t state_size, size_t capacity)
+      : state_size(state_size), ring(capacity), current(state_size),
+      scratch(2 * state_size + 16)
+   {
+      // Entry lengths are stored as u16.
+      if (scratch.size() > 0xffff)
+         throw logic_error("State is too large to rewind.");
+   }
+
+   void RewindBuffer::clear()
+   {
+      head = 0;
+      m_used = 0;
+      count = 0;
+      has_current = false;
+   }
+
+   uint16_t RewindBuffer::read_u16(size_t offset) const
+   {
+      return ring[wrap(offset)] | (ring[wrap(offset + 1)] << 8);
+   }
+
+   void RewindBuffer::write_u16(size_t offset, uint16_t val)
+   {
+      ring[wrap(offset + 0)] = uint8_t(val >> 0);
+      ring[wrap(offset + 1)] = uint8_t(val >> 8);
+   }
+
+   // Codes state ^ current into scratch.
+   size_t RewindBuffer::encode(const uint8_t* state)
+   {
+      auto out = scratch.data();
+      auto varint = [&out](size_t val) {
+         while (val >= 0x80)
+         {
+            *out++ = uint8_t(val | 0x80);
+            val >>= 7;
+         }
+         *out++ = uint8_t(val);
+      };
+
+      size_t i = 0;
+      while (i < state_size)
+      {
+         size_t zeros = i;
+         while (zeros < state_size && state[zeros] == current[zeros])
+            zeros++;
+
+         // A lone equal byte between changes is cheaper as a literal.
+         size_t literals = zeros;
+         while (literals < state_size &&
+               (state[literals] != current[literals] ||
+                (literals + 1 < state_size && state[literals + 1] != current[literals + 1])))
+            literals++;
+
+         varint(zeros - i);
+         varint(literals - zeros);
+         for (size_t j = zeros; j < literals; j++)
+            *out++ = state[j] ^ current[j];
+
+         i = literals;
+      }
+
+      return out - scratch.data();
+   }
+
+   // XORs the delta stored at start back into current.
+   void RewindBuffer::decode(size_t start, size_t len)
+   {
+      size_t pos = start, stop = start + len;
+      auto varint = [this, &pos]() {
+         size_t val = 0;
+         for (unsigned shift = 0; ; shift += 7)
+         {
+            uint8_t byte = ring[wrap(pos++)];
+            val |= size_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+               return val;
+         }
+      };
+
+      size_t i = 0;
+      while (pos < stop)
+      {
+         i += varint();
+         size_t literals = varint();
+         if (i + literals > state_size)
+            throw logic_error("Rewind delta is corrupt.");
+
+         for (size_t j = 0; j < literals; j++)
+            current[i++] ^= ring[wrap(pos++)];
+      }
+   }
+
+   void RewindBuffer::drop_oldest()
+   {
+      size_t tail = head + ring.size() - m_used;
+      size_t len = read_u16(tail);
+      m_used -= len + 4;
+      count--;
+   }
+
+   void RewindBuffer::push(const uint8_t* state)
+   {
+      if (ring.empty())
+         return;
+
+      if (!has_current)
+      {
+         copy(state, state + state_size, begin(current));
+         has_current = true;
+         return;
+      }
+
+      size_t len = encode(state);
+      size_t entry = len + 4;
+
+      if (entry > ring.size())
+      {
+         // Cannot keep even a single step, so start over from here.
+         clear();
+         push(state);
+         return;
+      }
+
+      while (m_used + entry > ring.size())
+         drop_oldest();
+
+      write_u16(head, len);
+      for (size_t i = 0; i < len; i++)
+         ring[wrap(head + 2 + i)] = scratch[i];
+      write_u16(head + 2 + len, len);
+
+      head = wrap(head + entry);
+      m_used += entry;
+      count++;
+
+      copy(state, state + state_size, begin(current));
+   }
+
+   bool RewindBuffer::pop(uint8_t* state)
+   {
+      if (!count)
+         return false;
+
+      size_t last = head + ring.size();
+      size_t len = read_u16(last - 2);
+      size_t start = last - 2 - len;
+
+      decode(start, len);
+
+      head = wrap(start - 2);
+      m_used -= len + 4;
+      count--;
+
+      copy(begin(current), end(current), state);
+      return true;
+   }
+
+   bool RewindBuffer::peek(uint8_t* state) const
+   {
+      if (!has_current)
+         return false;
+
+      copy(begin(current), end(current), state);
+      return true;
+   }
+}
+
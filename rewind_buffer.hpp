@@ -0,0 +1,61 @@
+#ifndef REWIND_BUFFER_HPP__
+#define REWIND_BUFFER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Blit
+{
+   // History of fixed size savestates, kept as compressed deltas in a byte ring.
+   // Each push stores the XOR of the new state against the last one,
+   // run-length coded, so frames where little changes cost a few bytes.
+   // When the ring is full the oldest deltas are dropped.
+   //
+   // Entry layout: u16 length, length bytes of tokens, u16 length.
+   // A token is varint zero run, varint literal count, then the literals.
+   class RewindBuffer
+   {
+      public:
+         RewindBuffer() = default;
+         RewindBuffer(std::size_t state_size, std::size_t capacity);
+
+         // Records state as the newest one.
+         void push(const std::uint8_t* state);
+
+         // Steps back one state and writes it to state.
+         // Returns false if there is nothing older.
+         bool pop(std::uint8_t* state);
+
+         // Writes the state the last pop() stepped back to, or the newest
+         // one, to state, without stepping. Returns false if there is none.
+         bool peek(std::uint8_t* state) const;
+
+         void clear();
+
+         unsigned frames() const { return count; }
+         std::size_t used() const { return m_used; }
+
+      private:
+         std::size_t state_size = 0;
+         std::vector<std::uint8_t> ring;
+         std::vector<std::uint8_t> current;
+         std::vector<std::uint8_t> scratch;
+
+         std::size_t head = 0;
+         std::size_t m_used = 0;
+         unsigned count = 0;
+         bool has_current = false;
+
+         std::size_t encode(const std::uint8_t* state);
+         void decode(std::size_t start, std::size_t len);
+         void drop_oldest();
+
+         std::size_t wrap(std::size_t offset) const { return offset % ring.size(); }
+         std::uint16_t read_u16(std::size_t offset) const;
+         void write_u16(std::size_t offset, std::uint16_t val);
+   };
+}
+
+#endif
+
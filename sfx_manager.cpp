@@ -1,4 +1,5 @@
 #include "game.hpp"
+#include "asset_pack.hpp"
 #include <string>
 #include <memory>
 
@@ -8,20 +9,43 @@ namespace Icy
 {
    void SFXManager::add_stream(const string &ident, const string &path)
    {
-      effects[ident] = make_shared<vector<float>>(Audio::WAVFile::load_wave(path));
+      Blit::AssetPack::Blob blob;
+      if (Blit::get_asset_pack().find(path, Blit::AssetPack::Type::PCM, blob))
+      {
+         effects[ident] = { static_cast<const float*>(blob.data), blob.size / sizeof(float), move(blob.owner) };
+         return;
+      }
+
+      auto pcm = make_shared<vector<float>>(Audio::WAVFile::load_wave(path));
+      effects[ident] = { pcm->data(), pcm->size(), pcm };
    }
 
-   void SFXManager::play_sfx(const string &ident, float volume) const
+   void SFXManager::play_sfx(const string &ident, float volume)
    {
       auto sfx = effects.find(ident);
       if (sfx == end(effects))
          throw runtime_error("Invalid SFX!");
 
-      auto duped = make_shared<Audio::PCMStream>(sfx->second);
-      duped->volume(volume);
+      // More effects than this in one frame could not be told apart anyway.
+      if (queued < queue_capacity)
+         queue[queued++] = { &sfx->second, volume };
+   }
+
+   void SFXManager::commit(bool audible)
+   {
       auto& mixer = get_mixer();
-      if (mixer.enabled())
-         mixer.add_stream(duped);
+      if (audible && mixer.enabled())
+      {
+         for (unsigned i = 0; i < queued; i++)
+         {
+            auto& effect = *queue[i].effect;
+            auto duped = make_shared<Audio::PCMStream>(effect.data, effect.samples, effect.owner);
+            duped->volume(queue[i].volume);
+            mixer.add_stream(duped);
+         }
+      }
+
+      queued = 0;
    }
 }
 
@@ -0,0 +1,210 @@
+#include "slide_map.hpp"
+#include <stdexcept>
+
+using namespace Blit;
+using namespace std;
+
+namespace Icy
+{
+   static const Pos dirs[4] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+
+   SlideMap::SlideMap(const Tilemap& map, const EntityStore& entities)
+      : m_width(map.tiles_width()), m_height(map.tiles_height()),
+      flags(m_width * m_height), blocks(m_width * m_height, -1)
+   {
+      if (m_width * m_height > 0xffff || entities.size() > 0x7fff)
+         throw logic_error("Map is too large for slide tables.");
+
+      Pos tile_size{map.tile_width(), map.tile_height()};
+
+      for (int y = 0; y < m_height; y++)
+      {
+         for (int x = 0; x < m_width; x++)
+         {
+            Pos tile{x, y};
+            auto& flag = flags[index(tile)];
+
+            if (map.collision(tile))
+               flag |= Wall;
+
+            auto floor = map.find_tile("floor", tile * tile_size);
+            if (floor && Utils::find_or_default(floor->attr(), "slippery_player", "") == "true")
+               flag |= SlipperyPlayer;
+            if (floor && Utils::find_or_default(floor->attr(), "slippery_block", "") == "true")
+               flag |= SlipperyBlock;
+            if (floor && Utils::find_or_default(floor->attr(), "goal", "") == "true")
+               flag |= Goal;
+         }
+      }
+
+      find_dead_tiles();
+
+      for (auto& mover : dest)
+         for (auto& table : mover)
+            table.resize(m_width * m_height);
+
+      place_blocks(entities.size(), [&](unsigned id) {
+               Pos pos = entities[id].surf.rect().pos;
+               return Pos{pos.x / tile_size.x, pos.y / tile_size.y};
+            });
+   }
+
+   void SlideMap::update_all()
+   {
+      for (int y = 0; y < m_height; y++)
+         update_row(y);
+      for (int x = 0; x < m_width; x++)
+         update_column(x);
+   }
+
+   bool SlideMap::inside(Pos tile) const
+   {
+      return tile.x >= 0 && tile.y >= 0 && tile.x < m_width && tile.y < m_height;
+   }
+
+   bool SlideMap::wall(Pos tile) const
+   {
+      return !inside(tile) || (flags[index(tile)] & Wall);
+   }
+
+   bool SlideMap::blocked(Pos tile) const
+   {
+      return wall(tile) || blocks[index(tile)] >= 0;
+   }
+
+   bool SlideMap::slippery(Pos tile, Mover mover) const
+   {
+      if (!inside(tile))
+         return false;
+      return flags[index(tile)] & (mover == Mover::Player ? SlipperyPlayer : SlipperyBlock);
+   }
+
+   bool SlideMap::goal(Pos tile) const
+   {
+      return inside(tile) && (flags[index(tile)] & Goal);
+   }
+
+   bool SlideMap::dead(Pos tile) const
+   {
+      return inside(tile) && (flags[index(tile)] & Dead);
+   }
+
+   // Works back from the goal floors to every tile a block can be pushed
+   // to one from. Other blocks can only stop a slide early, so the block
+   // is taken to stop wherever it likes along its slide, and the result
+   // holds whatever the blocks do. Only walls and ice decide it.
+   void SlideMap::find_dead_tiles()
+   {
+      vector<uint8_t> live(flags.size());
+      for (unsigned i = 0; i < flags.size(); i++)
+         live[i] = flags[i] & Goal;
+
+      for (bool changed = true; changed; )
+      {
+         changed = false;
+         for (int y = 0; y < m_height; y++)
+         {
+            for (int x = 0; x < m_width; x++)
+            {
+               Pos tile{x, y};
+               if (live[index(tile)] || wall(tile))
+                  continue;
+
+               for (auto& dir : dirs)
+               {
+                  // The player stands behind the block, the tile ahead is free.
+                  if (wall(tile - dir) || wall(tile + dir))
+                     continue;
+
+                  for (Pos stop = tile + dir; !live[index(tile)]; stop += dir)
+                  {
+                     live[index(tile)] = live[index(stop)];
+                     if (!slippery(stop, Mover::Block) || wall(stop + dir))
+                        break;
+                  }
+               }
+
+               changed |= live[index(tile)];
+            }
+         }
+      }
+
+      for (unsigned i = 0; i < flags.size(); i++)
+         if (!live[i] && !(flags[i] & Wall))
+            flags[i] |= Dead;
+   }
+
+   int SlideMap::block(Pos tile) const
+   {
+      return inside(tile) ? blocks[index(tile)] : -1;
+   }
+
+   unsigned SlideMap::dir_index(Pos dir)
+   {
+      for (unsigned i = 0; i < 4; i++)
+         if (dirs[i] == dir)
+            return i;
+      throw logic_error("Slide direction is not a unit step.");
+   }
+
+   Pos SlideMap::destination(Pos start, Pos dir, Mover mover) const
+   {
+      Pos next = start + dir;
+      if (blocked(next))
+         throw logic_error("Slide starts into a blocked tile.");
+
+      unsigned tile = dest[static_cast<unsigned>(mover)][dir_index(dir)][index(next)];
+      return {int(tile % m_width), int(tile / m_width)};
+   }
+
+   void SlideMap::move_block(Pos from, Pos to)
+   {
+      if (from == to)
+         return;
+
+      if (block(from) < 0 || blocked(to))
+         throw logic_error("Block moved from an empty tile or onto a blocked one.");
+
+      blocks[index(to)] = blocks[index(from)];
+      blocks[index(from)] = -1;
+
+      update_row(from.y);
+      update_column(from.x);
+      if (to.y != from.y)
+         update_row(to.y);
+      if (to.x != from.x)
+         update_column(to.x);
+   }
+
+   // Walks a row or column against dir, so each destination
+   // builds on the one of the tile ahead of it.
+   void SlideMap::update_run(Pos from, Pos dir)
+   {
+      unsigned d = dir_index(dir);
+      for (unsigned m = 0; m < 2; m++)
+      {
+         auto mover = static_cast<Mover>(m);
+         auto& table = dest[m][d];
+
+         for (Pos tile = from; inside(tile); tile -= dir)
+         {
+            Pos ahead = tile + dir;
+            bool stop = blocked(ahead) || !slippery(tile, mover);
+            table[index(tile)] = stop ? index(tile) : table[index(ahead)];
+         }
+      }
+   }
+
+   void SlideMap::update_row(int y)
+   {
+      update_run({m_width - 1, y}, {1, 0});
+      update_run({0, y}, {-1, 0});
+   }
+
+   void SlideMap::update_column(int x)
+   {
+      update_run({x, m_height - 1}, {0, 1});
+      update_run({x, 0}, {0, -1});
+   }
+}
+
@@ -0,0 +1,106 @@
+#ifndef SLIDE_MAP_HPP__
+#define SLIDE_MAP_HPP__
+
+#include "tilemap.hpp"
+#include "entity_store.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Icy
+{
+   // Where the player and blocks come to rest on ice.
+   //
+   // Moving from a tile, the mover always steps onto the next tile.
+   // It keeps going while the tile it is on is slippery for it
+   // and the tile ahead is free, so every tile has a fixed destination
+   // per direction. Those are kept in tables, computed when the level
+   // loads and recomputed for the rows and columns a block moves through.
+   //
+   // Outside the map counts as a wall.
+   //
+   // Tiles from which a block can never be pushed onto a goal floor are
+   // found once on load too, see dead().
+   class SlideMap
+   {
+      public:
+         enum class Mover : unsigned
+         {
+            Player = 0,
+            Block
+         };
+
+         SlideMap() = default;
+         SlideMap(const Blit::Tilemap& map, const EntityStore& entities);
+
+         int width() const { return m_width; }
+         int height() const { return m_height; }
+
+         bool inside(Blit::Pos tile) const;
+         bool wall(Blit::Pos tile) const;
+         bool blocked(Blit::Pos tile) const;
+         bool slippery(Blit::Pos tile, Mover mover) const;
+         bool goal(Blit::Pos tile) const;
+
+         // A goal block on tile can never reach a goal floor,
+         // whatever the other blocks do.
+         bool dead(Blit::Pos tile) const;
+         unsigned tile_index(Blit::Pos tile) const { return index(tile); }
+         Blit::Pos tile_at(unsigned index) const { return {int(index % m_width), int(index / m_width)}; }
+
+         // Entity ID of the block on tile, or -1.
+         int block(Blit::Pos tile) const;
+
+         // Where a move from start along dir, a unit step, comes to rest.
+         // The tile next to start must be free.
+         Blit::Pos destination(Blit::Pos start, Blit::Pos dir, Mover mover) const;
+
+         void move_block(Blit::Pos from, Blit::Pos to);
+
+         // Puts block id on tile_of(id) for every id below count,
+         // replacing all blocks, e.g. when restoring a savestate.
+         template <typename Func>
+         void place_blocks(unsigned count, Func&& tile_of)
+         {
+            std::fill(std::begin(blocks), std::end(blocks), -1);
+            for (unsigned id = 0; id < count; id++)
+            {
+               Blit::Pos tile = tile_of(id);
+               if (inside(tile))
+                  blocks[index(tile)] = id;
+            }
+            update_all();
+         }
+
+      private:
+         int m_width = 0, m_height = 0;
+
+         enum Flags : std::uint8_t
+         {
+            Wall            = 1 << 0,
+            SlipperyPlayer  = 1 << 1,
+            SlipperyBlock   = 1 << 2,
+            Goal            = 1 << 3,
+            Dead            = 1 << 4
+         };
+         std::vector<std::uint8_t> flags;
+         void find_dead_tiles();
+         std::vector<std::int16_t> blocks;
+
+         // Tile index of the destination when arriving at a tile,
+         // by mover, then direction (see dir_index).
+         std::vector<std::uint16_t> dest[2][4];
+
+         int index(Blit::Pos tile) const { return tile.y * m_width + tile.x; }
+         static unsigned dir_index(Blit::Pos dir);
+
+         void update_run(Blit::Pos from, Blit::Pos dir);
+         void update_row(int y);
+         void update_column(int x);
+         void update_all();
+   };
+}
+
+#endif
+
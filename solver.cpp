@@ -0,0 +1,897 @@
+#include "solver.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace Blit;
+using namespace std;
+
+namespace Icy
+{
+   static const Pos dirs[4] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+
+   // Index of the lowest set bit of word, which is not zero (de Bruijn multiply).
+   static unsigned lowest_bit(uint64_t word)
+   {
+      static const uint8_t index[64] = {
+         0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48, 28,
+         62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11,
+         63, 52, 6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+         51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12,
+      };
+      return index[((word & (~word + 1)) * 0x022fdd63cc95386dull) >> 58];
+   }
+
+   Puzzle::Puzzle(const SlideMap& slides, const EntityStore& entities, Pos player)
+      : width(slides.width()), height(slides.height()), flags(width * height), player(player)
+   {
+      for (int y = 0; y < height; y++)
+      {
+         for (int x = 0; x < width; x++)
+         {
+            Pos tile{x, y};
+            auto& flag = flags[y * width + x];
+
+            if (slides.wall(tile))
+               flag |= Wall;
+            if (slides.slippery(tile, SlideMap::Mover::Player))
+               flag |= SlipperyPlayer;
+            if (slides.slippery(tile, SlideMap::Mover::Block))
+               flag |= SlipperyBlock;
+            if (slides.goal(tile))
+               flag |= Goal;
+            if (slides.dead(tile))
+               flag |= Dead;
+
+            int id = slides.block(tile);
+            if (id >= 0)
+               (entities[id].goal ? goal_blocks : other_blocks).push_back(tile);
+         }
+      }
+   }
+
+   // Open addressing set of state hashes, shared by every search thread.
+   // Slots are claimed with compare-and-swap, so inserting never locks.
+   // Zero marks an empty slot. It only grows between layers, when no
+   // thread is inserting.
+   class Solver::Table
+   {
+      public:
+         enum class Insert { Added, Seen, Full };
+
+         explicit Table(size_t capacity) { reset(capacity); }
+
+         size_t capacity() const { return mask + 1; }
+
+         Insert insert(uint64_t hash)
+         {
+            if (!hash)
+               hash = 1;
+
+            if (count.load(memory_order_relaxed) >= limit)
+               return Insert::Full;
+
+            for (size_t i = hash & mask; ; i = (i + 1) & mask)
+            {
+               uint64_t slot = slots[i].load(memory_order_relaxed);
+               if (slot == hash)
+                  return Insert::Seen;
+
+               if (!slot)
+               {
+                  if (slots[i].compare_exchange_strong(slot, hash, memory_order_relaxed))
+                  {
+                     count.fetch_add(1, memory_order_relaxed);
+                     return Insert::Added;
+                  }
+
+                  // Lost the slot, maybe to the same state.
+                  if (slot == hash)
+                     return Insert::Seen;
+               }
+            }
+         }
+
+         // Empties the table.
+         void reset(size_t capacity)
+         {
+            slots.reset(new atomic<uint64_t>[capacity]);
+            for (size_t i = 0; i < capacity; i++)
+               slots[i].store(0, memory_order_relaxed);
+            mask = capacity - 1;
+            limit = capacity / 4 * 3;
+            count.store(0, memory_order_relaxed);
+         }
+
+         void resize(size_t capacity)
+         {
+            auto old = move(slots);
+            size_t old_capacity = old ? mask + 1 : 0;
+            reset(capacity);
+
+            for (size_t i = 0; i < old_capacity; i++)
+            {
+               uint64_t hash = old[i].load(memory_order_relaxed);
+               if (hash)
+                  insert(hash);
+            }
+         }
+
+      private:
+         unique_ptr<atomic<uint64_t>[]> slots;
+         size_t mask = 0;
+         size_t limit = 0;
+         atomic<size_t> count;
+   };
+
+   // Search threads, started once per solve(). Each round wakes them all to
+   // run(index), runs run(0) on the calling thread, and waits for the rest.
+   class Solver::Pool
+   {
+      public:
+         Pool(unsigned count, function<void (unsigned)> run) : run(move(run))
+         {
+            for (unsigned i = 1; i < count; i++)
+               threads.emplace_back([this, i] { serve(i); });
+         }
+
+         ~Pool()
+         {
+            {
+               lock_guard<mutex> hold(lock);
+               stop = true;
+            }
+            start.notify_all();
+            for (auto& thread : threads)
+               thread.join();
+         }
+
+         void round()
+         {
+            {
+               lock_guard<mutex> hold(lock);
+               busy = threads.size();
+               generation++;
+            }
+            start.notify_all();
+
+            run(0);
+
+            unique_lock<mutex> hold(lock);
+            done.wait(hold, [this] { return !busy; });
+         }
+
+      private:
+         function<void (unsigned)> run;
+         vector<thread> threads;
+
+         mutex lock;
+         condition_variable start, done;
+         unsigned generation = 0;
+         unsigned busy = 0;
+         bool stop = false;
+
+         void serve(unsigned index)
+         {
+            unsigned seen = 0;
+            for (;;)
+            {
+               {
+                  unique_lock<mutex> hold(lock);
+                  start.wait(hold, [&] { return stop || generation != seen; });
+                  if (stop)
+                     return;
+                  seen = generation;
+               }
+
+               run(index);
+
+               lock_guard<mutex> hold(lock);
+               if (!--busy)
+                  done.notify_one();
+            }
+         }
+   };
+
+   // Scratch space of one search thread.
+   struct Solver::Worker
+   {
+      // Per tile: 0 if free, slot of the block in the state, or wall.
+      array<uint8_t, 256> blocked;
+      // Of the state in blocked: hash without the player, and estimate().
+      uint64_t blocks_hash;
+      unsigned pushes;
+      vector<uint8_t> reached;
+
+      // Tarjan's algorithm, see connect().
+      struct Call
+      {
+         uint8_t tile, dir;
+      };
+      array<uint16_t, 256> order, low;
+      array<Call, 256> calls;
+      array<uint8_t, 256> stack;
+
+      // Tiles walked to by the last connect().
+      Tiles reach;
+
+      // Canonical tiles found lately, by hash of the blocks. Pushes often
+      // end with the same blocks, see canonical().
+      struct Cached
+      {
+         uint64_t blocks;
+         array<uint8_t, 256> tiles; // Canonical tile per tile, or outside.
+         Tiles reach;               // Tiles walked to from reach_player.
+         uint8_t reach_player;      // Canonical tile, or outside.
+      };
+      enum { cache_size = 1 << 12 };
+      vector<Cached> cache;
+
+      vector<Node> out;
+      vector<Deferred> deferred;
+      Win win;
+      bool full = false;
+   };
+
+   Solver::Solver(const Puzzle& puzzle, unsigned threads, size_t max_states)
+      : width(puzzle.width),
+      goal_count(puzzle.goal_blocks.size()),
+      block_count(puzzle.goal_blocks.size() + puzzle.other_blocks.size()),
+      threads(threads ? threads : max(thread::hardware_concurrency(), 1u)),
+      max_states(max_states), cancelled(false)
+   {
+      unsigned tiles = puzzle.width * puzzle.height;
+      if (tiles >= outside)
+         throw runtime_error("Level is too large for the solver.");
+      if (block_count > max_blocks)
+         throw runtime_error(Utils::join("Level has more than ", unsigned(max_blocks), " blocks to solve."));
+
+      unsigned goal_floor = count_if(begin(puzzle.flags), end(puzzle.flags),
+            [](uint8_t flag) { return flag & Puzzle::Goal; });
+      if (goal_floor != goal_count)
+         throw logic_error("Number of goal floors and goal blocks do not match.");
+      if (!goal_count)
+         throw logic_error("Goal floor or blocks are empty.");
+
+      // Everything past the map, including the outside tile, is wall.
+      flags.fill(Puzzle::Wall);
+      copy(begin(puzzle.flags), end(puzzle.flags), begin(flags));
+      for (unsigned tile = 0; tile < walls.size(); tile++)
+         walls[tile] = flags[tile] & Puzzle::Wall ? wall : 0;
+
+      for (unsigned d = 0; d < 4; d++)
+      {
+         step[d].fill(outside);
+         for (unsigned tile = 0; tile < tiles; tile++)
+         {
+            int x = tile % width + dirs[d].x;
+            int y = tile / width + dirs[d].y;
+            if (x >= 0 && y >= 0 && x < puzzle.width && y < puzzle.height)
+               step[d][tile] = y * width + x;
+         }
+      }
+
+      find_distances();
+
+      auto index = [this](Pos tile) { return uint8_t(tile.y * width + tile.x); };
+      start.fill(0);
+      start[0] = index(puzzle.player);
+      for (unsigned i = 0; i < goal_count; i++)
+         start[1 + i] = index(puzzle.goal_blocks[i]);
+      for (unsigned i = goal_count; i < block_count; i++)
+         start[1 + i] = index(puzzle.other_blocks[i - goal_count]);
+
+      // Fixed keys, so hashes and thus solutions do not depend on the run.
+      uint64_t seed = 0x9e3779b97f4a7c15ull;
+      for (auto& keys : zobrist)
+      {
+         for (auto& key : keys)
+         {
+            // splitmix64
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            key = z ^ (z >> 31);
+         }
+      }
+   }
+
+   uint64_t Solver::hash(const State& state) const
+   {
+      uint64_t hash = zobrist[0][state[0]];
+      for (unsigned i = 0; i < goal_count; i++)
+         hash ^= zobrist[1][state[1 + i]];
+      for (unsigned i = goal_count; i < block_count; i++)
+         hash ^= zobrist[2][state[1 + i]];
+      return hash;
+   }
+
+   bool Solver::won(const State& state) const
+   {
+      for (unsigned i = 0; i < goal_count; i++)
+         if (!(flags[state[1 + i]] & Puzzle::Goal))
+            return false;
+      return true;
+   }
+
+   bool Solver::dead(const State& state) const
+   {
+      for (unsigned i = 0; i < goal_count; i++)
+         if (flags[state[1 + i]] & Puzzle::Dead)
+            return true;
+      return false;
+   }
+
+   // As SlideMap::find_dead_tiles(), but counting pushes. A block which
+   // starts on a wall takes at least the push off it.
+   void Solver::find_distances()
+   {
+      distance.fill(0xff);
+      for (unsigned tile = 0; tile < distance.size(); tile++)
+      {
+         if (flags[tile] & Puzzle::Goal)
+            distance[tile] = 0;
+         else if (walls[tile])
+            distance[tile] = 1;
+      }
+
+      for (bool changed = true; changed; )
+      {
+         changed = false;
+         for (unsigned tile = 0; tile < distance.size(); tile++)
+         {
+            if (walls[tile])
+               continue;
+
+            for (unsigned d = 0; d < 4; d++)
+            {
+               // The player stands behind the block. Directions come in pairs.
+               if (walls[step[d ^ 1][tile]])
+                  continue;
+
+               for (uint8_t stop = step[d][tile]; !walls[stop]; stop = step[d][stop])
+               {
+                  if (distance[stop] + 1 < distance[tile])
+                  {
+                     distance[tile] = distance[stop] + 1;
+                     changed = true;
+                  }
+                  if (!(flags[stop] & Puzzle::SlipperyBlock))
+                     break;
+               }
+            }
+         }
+      }
+   }
+
+   // Never more pushes than it takes to win from state.
+   unsigned Solver::estimate(const State& state) const
+   {
+      unsigned pushes = 0;
+      for (unsigned i = 0; i < goal_count; i++)
+         pushes += distance[state[1 + i]];
+      return pushes;
+   }
+
+   // Same rule as SlideMap: always step onto tile, then keep going while
+   // it is slippery for the mover and the tile ahead is free.
+   uint8_t Solver::slide(uint8_t tile, unsigned dir, uint8_t mover, const Worker& worker) const
+   {
+      while (flags[tile] & mover)
+      {
+         uint8_t next = step[dir][tile];
+         if (worker.blocked[next])
+            break;
+         tile = next;
+      }
+      return tile;
+   }
+
+   // Puts the blocks of state in worker.
+   void Solver::place(Worker& worker, const State& state) const
+   {
+      worker.blocked = walls;
+      for (unsigned i = 1; i <= block_count; i++)
+         worker.blocked[state[i]] = i;
+
+      worker.blocks_hash = hash(state) ^ zobrist[0][state[0]];
+      worker.pushes = estimate(state);
+   }
+
+   // Puts the blocks of node in worker, and lists the tiles the player can walk to.
+   void Solver::reach(Worker& worker, const Node& node) const
+   {
+      place(worker, node.state);
+
+      worker.reached.clear();
+      for (unsigned i = 0; i < 4; i++)
+         for (uint64_t word = node.reach.bits[i]; word; word &= word - 1)
+            worker.reached.push_back(i * 64 + lowest_bit(word));
+   }
+
+   // Strongly connected sets of the tiles the player can walk to from player,
+   // with the blocks as in worker: those it can walk to and back from.
+   // Walks slide, so they are not always reversible. The smallest tile of
+   // each set is its canonical tile. Tarjan's algorithm, without recursion,
+   // which also leaves every tile walked to in worker.reach.
+   void Solver::connect(Worker& worker, uint8_t player, array<uint8_t, 256>& canonical) const
+   {
+      enum : uint16_t { done = 0xffff }; // Tile is in a set which is complete.
+      auto& order = worker.order;
+      auto& low = worker.low;
+      order.fill(0);
+      worker.reach = Tiles{};
+
+      unsigned count = 0, depth = 0, top = 0;
+      auto visit = [&](uint8_t tile) {
+         worker.reach.set(tile);
+         order[tile] = low[tile] = ++count;
+         worker.stack[top++] = tile;
+         worker.calls[depth++] = {tile, 0};
+      };
+      visit(player);
+
+      for (;;)
+      {
+         auto& call = worker.calls[depth - 1];
+         uint8_t tile = call.tile;
+         if (call.dir < 4)
+         {
+            unsigned d = call.dir++;
+            uint8_t next = step[d][tile];
+            if (worker.blocked[next])
+               continue;
+
+            uint8_t dest = slide(next, d, Puzzle::SlipperyPlayer, worker);
+            if (!order[dest])
+               visit(dest);
+            else if (low[dest] != done)
+               low[tile] = min(low[tile], order[dest]);
+            continue;
+         }
+
+         depth--;
+         if (low[tile] != order[tile])
+         {
+            auto& parent = worker.calls[depth - 1].tile;
+            low[parent] = min(low[parent], low[tile]);
+            continue;
+         }
+
+         // tile is the first of a set, which is on top of the stack.
+         // The set of player is the last to complete.
+         unsigned first = top;
+         while (worker.stack[--first] != tile)
+            ;
+
+         uint8_t smallest = *min_element(&worker.stack[first], &worker.stack[top]);
+         for (unsigned i = first; i < top; i++)
+         {
+            canonical[worker.stack[i]] = smallest;
+            low[worker.stack[i]] = done;
+         }
+         top = first;
+
+         if (tile == player)
+            return;
+      }
+   }
+
+   // Canonical tile of player, with the blocks as in worker, which hash to blocks.
+   uint8_t Solver::canonical(Worker& worker, uint64_t blocks, uint8_t player) const
+   {
+      auto& cached = worker.cache[blocks & (Worker::cache_size - 1)];
+      if (cached.blocks != blocks)
+      {
+         cached.blocks = blocks;
+         cached.tiles.fill(outside);
+         cached.reach_player = outside;
+      }
+
+      if (cached.tiles[player] == outside)
+      {
+         connect(worker, player, cached.tiles);
+         cached.reach = worker.reach;
+         cached.reach_player = cached.tiles[player];
+      }
+      return cached.tiles[player];
+   }
+
+   // Blocks in a 2x2 square of walls and blocks can never be pushed again,
+   // so the level is lost if one of them is misplaced: a goal block off
+   // the goal floor, or another block on it.
+   bool Solver::frozen(const Worker& worker, uint8_t tile) const
+   {
+      static const unsigned squares[4][2] = { {0, 2}, {0, 3}, {1, 2}, {1, 3} };
+      for (auto& square : squares)
+      {
+         uint8_t vertical = step[square[0]][tile];
+         uint8_t tiles[4] = { tile, vertical, step[square[1]][tile], step[square[1]][vertical] };
+         if (!all_of(begin(tiles), end(tiles), [&worker](uint8_t t) { return worker.blocked[t]; }))
+            continue;
+
+         for (auto t : tiles)
+         {
+            uint8_t slot = worker.blocked[t];
+            if (slot != wall && (slot <= goal_count) != bool(flags[t] & Puzzle::Goal))
+               return true;
+         }
+      }
+      return false;
+   }
+
+   // Only a push of a goal block, with every other one in place,
+   // can win. Goals are checked on every tile the block passes.
+   void Solver::find_win(Worker& worker, const vector<Node>& layer, uint32_t index) const
+   {
+      auto& state = layer[index].state;
+
+      unsigned off_goal = 0;
+      for (unsigned i = 0; i < goal_count; i++)
+         off_goal += !(flags[state[1 + i]] & Puzzle::Goal);
+      if (off_goal != 1)
+         return;
+
+      reach(worker, layer[index]);
+
+      for (auto player : worker.reached)
+      {
+         for (unsigned d = 0; d < 4; d++)
+         {
+            uint8_t from = step[d][player];
+            uint8_t slot = worker.blocked[from];
+            uint8_t next = step[d][from];
+
+            // Only the goal block which is off its goal can finish.
+            if (!slot || slot > goal_count || (flags[from] & Puzzle::Goal) || worker.blocked[next])
+               continue;
+
+            uint8_t dest = slide(next, d, Puzzle::SlipperyBlock, worker);
+            for (uint8_t tile = next; ; tile = step[d][tile])
+            {
+               if (flags[tile] & Puzzle::Goal)
+               {
+                  if (index < worker.win.parent)
+                  {
+                     worker.win.parent = index;
+                     worker.win.player = player;
+                     worker.win.dir    = d;
+                  }
+                  return;
+               }
+
+               if (tile == dest)
+                  break;
+            }
+         }
+      }
+   }
+
+   // The player pushes from player in direction d, with the blocks of state,
+   // the state at index of its layer, in worker. A push which leads to a state
+   // not seen before adds it to worker.out, unless winning from there takes
+   // more than budget pushes, then it goes to worker.deferred.
+   void Solver::push(Worker& worker, Table& table, const State& state, uint32_t index,
+         uint8_t player, unsigned d, unsigned budget) const
+   {
+      uint8_t from = step[d][player];
+      uint8_t slot = worker.blocked[from];
+      uint8_t next = step[d][from];
+      if (!slot || slot == wall || worker.blocked[next])
+         return;
+
+      uint8_t dest = slide(next, d, Puzzle::SlipperyBlock, worker);
+      bool goal = slot <= goal_count;
+      if (goal && (flags[dest] & Puzzle::Dead))
+         return;
+
+      unsigned pushes = goal ? worker.pushes - distance[from] + distance[dest] : worker.pushes;
+      if (pushes > budget)
+      {
+         worker.deferred.push_back({index, player, uint8_t(d), uint16_t(pushes)});
+         return;
+      }
+
+      auto& keys = zobrist[goal ? 1 : 2];
+      uint64_t child_blocks = worker.blocks_hash ^ keys[from] ^ keys[dest];
+
+      // The player stays where it pushed from. Blocks are moved in
+      // worker for a look at the child, and put back after. A block
+      // can start on a wall, which is left behind.
+      worker.blocked[from] = walls[from];
+      worker.blocked[dest] = slot;
+
+      if (!frozen(worker, dest))
+      {
+         Node child{state, {}, index, player, uint8_t(d)};
+         child.state[0] = canonical(worker, child_blocks, player);
+         child.state[slot] = dest;
+
+         switch (table.insert(child_blocks ^ zobrist[0][child.state[0]]))
+         {
+            case Table::Insert::Added:
+            {
+               auto& cached = worker.cache[child_blocks & (Worker::cache_size - 1)];
+               if (cached.reach_player != child.state[0])
+               {
+                  connect(worker, player, cached.tiles);
+                  cached.reach = worker.reach;
+                  cached.reach_player = child.state[0];
+               }
+               child.reach = cached.reach;
+               worker.out.push_back(child);
+               break;
+            }
+            case Table::Insert::Full:
+               worker.full = true;
+               break;
+            case Table::Insert::Seen:
+               break;
+         }
+      }
+
+      worker.blocked[dest] = 0;
+      worker.blocked[from] = slot;
+   }
+
+   void Solver::expand(Worker& worker, Table& table, const vector<Node>& layer, uint32_t index,
+         unsigned budget) const
+   {
+      reach(worker, layer[index]);
+
+      for (auto player : worker.reached)
+         for (unsigned d = 0; d < 4 && !worker.full; d++)
+            push(worker, table, layer[index].state, index, player, d, budget);
+   }
+
+   // Makes a deferred push into the layer after layer.
+   void Solver::promote(Worker& worker, Table& table, const vector<Node>& layer, const Deferred& deferred,
+         unsigned budget) const
+   {
+      auto& state = layer[deferred.parent].state;
+      place(worker, state);
+      push(worker, table, state, deferred.parent, deferred.pusher, deferred.dir, budget);
+   }
+
+   Solver::Push Solver::make_push(unsigned player, unsigned dir, const State& state) const
+   {
+      Worker worker;
+      place(worker, state);
+
+      uint8_t dest = slide(step[dir][step[dir][player]], dir, Puzzle::SlipperyBlock, worker);
+      auto pos = [this](unsigned tile) { return Pos{int(tile % width), int(tile / width)}; };
+      return {pos(player), dirs[dir], pos(dest)};
+   }
+
+   Solver::Result Solver::solve()
+   {
+      Result result;
+      if (won(start))
+      {
+         result.solved = true;
+         return result;
+      }
+
+      if (dead(start))
+         return result;
+
+      size_t max_capacity = 1;
+      while (max_capacity / 4 * 3 < max_states)
+         max_capacity <<= 1;
+
+      vector<Worker> workers(threads);
+
+      for (auto& worker : workers)
+         worker.cache.assign(Worker::cache_size, Worker::Cached());
+
+      State first = start;
+      place(workers[0], first);
+      first[0] = canonical(workers[0], workers[0].blocks_hash, first[0]);
+
+      Table table(min(size_t(1) << 12, max_capacity));
+      table.insert(hash(first));
+
+      // Per push count: the states, how many of them are expanded,
+      // and the pushes into them which are deferred.
+      vector<vector<Node>> layers;
+      vector<size_t> expanded;
+      vector<vector<Deferred>> deferred;
+      layers.push_back({Node{first, workers[0].reach, 0, 0, 0}});
+      expanded.push_back(0);
+      deferred.emplace_back();
+      size_t stored = 1;
+      size_t growth = 4;
+
+      // The round run by every thread of the pool, set by parallel().
+      enum { chunk = 64 };
+      size_t count = 0;
+      const function<void (Worker&, uint32_t)>* work = nullptr;
+      atomic<size_t> next(0);
+
+      Pool pool(threads, [&](unsigned index) {
+               auto& worker = workers[index];
+               size_t first;
+               while ((first = next.fetch_add(chunk)) < count)
+               {
+                  size_t last = min(first + chunk, count);
+                  for (size_t i = first; i < last && !worker.full && !cancelled; i++)
+                     (*work)(worker, i);
+               }
+            });
+
+      // Runs work count times, spread over the workers.
+      auto parallel = [&](size_t times, const function<void (Worker&, uint32_t)>& job) {
+         count = times;
+         work = &job;
+         next = 0;
+         pool.round();
+      };
+
+      // Runs work count times, which adds states to layer and defers pushes
+      // to cut. Sized by how much the last run grew. Should the table fill
+      // up anyway, it is rebuilt larger and work is run again.
+      auto grow = [&](size_t count, const function<void (Worker&, uint32_t)>& work,
+            vector<Node>& layer, vector<Deferred>& cut) {
+         size_t capacity = table.capacity();
+         while (capacity / 4 * 3 < stored + count * growth && capacity < max_capacity)
+            capacity <<= 1;
+         if (capacity != table.capacity())
+            table.resize(capacity);
+
+         for (;;)
+         {
+            parallel(count, work);
+
+            bool full = false;
+            for (auto& worker : workers)
+               full |= worker.full;
+
+            if (cancelled)
+               return false;
+            if (!full)
+               break;
+
+            for (auto& worker : workers)
+            {
+               worker.out.clear();
+               worker.deferred.clear();
+               worker.full = false;
+            }
+
+            if (table.capacity() >= max_capacity)
+               return false;
+
+            // States the cache says are seen may have been dropped.
+            table.reset(table.capacity() * 2);
+            for (auto& nodes : layers)
+               for (auto& node : nodes)
+                  table.insert(hash(node.state));
+            for (auto& worker : workers)
+               worker.cache.assign(Worker::cache_size, Worker::Cached());
+         }
+
+         // Reserved to fit, as every state is kept till the end.
+         size_t added = 0, deferred = 0;
+         for (auto& worker : workers)
+         {
+            added += worker.out.size();
+            deferred += worker.deferred.size();
+         }
+         layer.reserve(layer.size() + added);
+         cut.reserve(cut.size() + deferred);
+
+         for (auto& worker : workers)
+         {
+            layer.insert(end(layer), begin(worker.out), end(worker.out));
+            cut.insert(end(cut), begin(worker.deferred), end(worker.deferred));
+            vector<Node>().swap(worker.out);
+            vector<Deferred>().swap(worker.deferred);
+         }
+
+         growth = added / count + 1;
+         stored += added;
+         result.states = stored;
+         return stored <= max_states;
+      };
+
+      // Each pass goes over every push count, adds the deferred pushes which
+      // fit the bound now, and expands the states which are new.
+      for (unsigned bound = estimate(start); ; )
+      {
+         for (size_t depth = 0; depth < layers.size(); depth++)
+         {
+            // No state is as deep as bound, as it would have been won.
+            unsigned budget = bound - depth;
+
+            vector<Deferred> fits;
+            auto kept = partition(begin(deferred[depth]), end(deferred[depth]),
+                  [=](const Deferred& push) { return push.pushes > budget; });
+            fits.assign(kept, end(deferred[depth]));
+            deferred[depth].erase(kept, end(deferred[depth]));
+            deferred[depth].shrink_to_fit();
+
+            if (!fits.empty() && !grow(fits.size(), [&](Worker& worker, uint32_t i) {
+                     promote(worker, table, layers[depth - 1], fits[i], budget); },
+                     layers[depth], deferred[depth]))
+            {
+               result.exhausted = true;
+               return result;
+            }
+
+            auto& layer = layers[depth];
+            size_t first = expanded[depth];
+            if (first == layer.size())
+               continue;
+
+            // Wins are looked for before the next layer is built,
+            // as that is by far the largest one.
+            parallel(layer.size() - first, [&](Worker& worker, uint32_t i) { find_win(worker, layer, first + i); });
+
+            if (cancelled)
+            {
+               result.exhausted = true;
+               return result;
+            }
+
+            Win win;
+            for (auto& worker : workers)
+            {
+               if (worker.win.parent < win.parent)
+                  win = worker.win;
+               worker.win = Win();
+            }
+
+            if (win.parent != ~0u)
+            {
+               result.solved = true;
+               result.pushes.push_back(make_push(win.player, win.dir, layer[win.parent].state));
+
+               uint32_t index = win.parent;
+               for (size_t d = depth; d > 0; d--)
+               {
+                  auto& node = layers[d][index];
+                  auto& parent = layers[d - 1][node.parent];
+                  result.pushes.push_back(make_push(node.pusher, node.dir, parent.state));
+                  index = node.parent;
+               }
+
+               reverse(begin(result.pushes), end(result.pushes));
+               return result;
+            }
+
+            if (depth + 1 == layers.size())
+            {
+               layers.emplace_back();
+               expanded.push_back(0);
+               deferred.emplace_back();
+            }
+
+            size_t last = layers[depth].size();
+            if (!grow(last - first, [&](Worker& worker, uint32_t i) {
+                     expand(worker, table, layers[depth], first + i, budget - 1); },
+                     layers[depth + 1], deferred[depth + 1]))
+            {
+               result.exhausted = true;
+               return result;
+            }
+            expanded[depth] = last;
+         }
+
+         // The next bound is the least any deferred push needs.
+         unsigned next = ~0u;
+         for (size_t depth = 0; depth < deferred.size(); depth++)
+            for (auto& push : deferred[depth])
+               next = min(next, unsigned(depth) + push.pushes);
+
+         if (next == ~0u)
+            return result;
+         bound = next;
+      }
+   }
+}
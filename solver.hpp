@@ -0,0 +1,172 @@
+#ifndef SOLVER_HPP__
+#define SOLVER_HPP__
+
+#include "entity_store.hpp"
+#include "slide_map.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Icy
+{
+   // A level as the solver sees it, taken from the SlideMap of a loaded level,
+   // with the blocks and the player where they are right now.
+   struct Puzzle
+   {
+      Puzzle(const SlideMap& slides, const EntityStore& entities, Blit::Pos player);
+
+      enum Flags : std::uint8_t
+      {
+         Wall            = 1 << 0,
+         SlipperyPlayer  = 1 << 1,
+         SlipperyBlock   = 1 << 2,
+         Goal            = 1 << 3,
+         Dead            = 1 << 4  // See SlideMap::dead().
+      };
+
+      int width, height;
+      std::vector<std::uint8_t> flags;
+      std::vector<Blit::Pos> goal_blocks;
+      std::vector<Blit::Pos> other_blocks;
+      Blit::Pos player;
+   };
+
+   // Finds solutions with the fewest pushes, by the rules of Game: the player
+   // walks and blocks are pushed one tile, both slide on ice, and the level
+   // is won as soon as every goal block lines up with a goal floor, which can
+   // happen while a block slides across one.
+   //
+   // The search goes breadth first by pushes. Walking is free, so a state
+   // is the set of block tiles and where the player can walk, one byte each.
+   // Walks slide on ice, so they are not always reversible. The player is
+   // kept as the smallest tile of the strongly connected set of tiles it
+   // can walk to and back from, as it could stand on any of them.
+   // Pushes which freeze a misplaced block in a 2x2 square, see
+   // Game::stuck_at(), are not searched further.
+   // Only states which could still be won within a bound on pushes are
+   // searched, counting the fewest pushes each goal block needs to reach a
+   // goal floor. Pushes past the bound are put off, and while there is no
+   // solution, the bound is raised to the least of those, which are made then.
+   // States already seen are kept as Zobrist hashes in a transposition table
+   // which every thread inserts into with compare-and-swap. Each push count
+   // is expanded by all threads, taking states from a shared counter.
+   class Solver
+   {
+      public:
+         // The player stands on player, faces dir and pushes.
+         // The block ahead comes to rest on block_dest.
+         struct Push
+         {
+            Blit::Pos player;
+            Blit::Pos dir;
+            Blit::Pos block_dest;
+         };
+
+         struct Result
+         {
+            bool solved = false;
+            // The search hit max_states, or was cancelled, before it could decide.
+            bool exhausted = false;
+            std::vector<Push> pushes;
+            std::size_t states = 0;
+         };
+
+         // threads: 0 for one per core.
+         Solver(const Puzzle& puzzle, unsigned threads = 0,
+               std::size_t max_states = std::size_t(1) << 22);
+
+         Result solve();
+
+         // Makes solve() give up soon, from any thread.
+         void cancel() { cancelled = true; }
+
+         enum { max_blocks = 15 };
+
+      private:
+         // Canonical player tile, then goal block tiles, then other block tiles.
+         // Blocks of a kind are interchangeable, and hashes do not depend
+         // on their order, so they are not kept sorted.
+         typedef std::array<std::uint8_t, max_blocks + 1> State;
+
+         // One bit per tile.
+         struct Tiles
+         {
+            std::array<std::uint64_t, 4> bits;
+
+            bool test(unsigned tile) const { return bits[tile >> 6] >> (tile & 63) & 1; }
+            void set(unsigned tile) { bits[tile >> 6] |= std::uint64_t(1) << (tile & 63); }
+         };
+
+         struct Node
+         {
+            State state;
+            Tiles reach; // Tiles the player can walk to.
+            std::uint32_t parent;
+            std::uint8_t pusher; // Tile the player pushed from.
+            std::uint8_t dir;
+         };
+
+         // A push cut off by the bound, from the state at parent of the layer before.
+         struct Deferred
+         {
+            std::uint32_t parent;
+            std::uint8_t pusher, dir;
+            std::uint16_t pushes; // estimate() of the state it leads to.
+         };
+
+         struct Win
+         {
+            std::uint32_t parent = ~0u;
+            std::uint8_t player, dir;
+         };
+
+         // Tile indices fit a byte, and 0xff is left for outside the map.
+         enum : std::uint8_t { outside = 0xff, wall = 0xff };
+
+         int width;
+         unsigned goal_count, block_count;
+         unsigned threads;
+         std::size_t max_states;
+         std::atomic<bool> cancelled;
+         State start;
+
+         std::array<std::uint8_t, 256> flags;
+         std::array<std::uint8_t, 256> walls;
+         std::array<std::array<std::uint8_t, 256>, 4> step;
+         // Fewest pushes a goal block needs to reach a goal floor from each
+         // tile, were its slides free to stop anywhere. 1 on walls.
+         std::array<std::uint8_t, 256> distance;
+
+         std::array<std::array<std::uint64_t, 256>, 3> zobrist;
+         std::uint64_t hash(const State& state) const;
+
+         class Table;
+         class Pool;
+         struct Worker;
+
+         bool won(const State& state) const;
+         bool dead(const State& state) const;
+         unsigned estimate(const State& state) const;
+         void find_distances();
+         void place(Worker& worker, const State& state) const;
+         void reach(Worker& worker, const Node& node) const;
+         void connect(Worker& worker, std::uint8_t player, std::array<std::uint8_t, 256>& canonical) const;
+         std::uint8_t canonical(Worker& worker, std::uint64_t blocks, std::uint8_t player) const;
+         bool frozen(const Worker& worker, std::uint8_t tile) const;
+         void find_win(Worker& worker, const std::vector<Node>& layer, std::uint32_t index) const;
+         void push(Worker& worker, Table& table, const State& state, std::uint32_t index,
+               std::uint8_t player, unsigned dir, unsigned budget) const;
+         void expand(Worker& worker, Table& table, const std::vector<Node>& layer, std::uint32_t index,
+               unsigned budget) const;
+         void promote(Worker& worker, Table& table, const std::vector<Node>& layer, const Deferred& deferred,
+               unsigned budget) const;
+         std::uint8_t slide(std::uint8_t tile, unsigned dir, std::uint8_t mover, const Worker& worker) const;
+         Push make_push(unsigned player, unsigned dir, const State& state) const;
+   };
+}
+
+#endif
+
@@ -0,0 +1,113 @@
+#ifndef STATE_STREAM_HPP__
+#define STATE_STREAM_HPP__
+
+#include "blit.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace Blit
+{
+   // Little-endian writer into a caller provided buffer, for savestates.
+   // Never allocates. Writing past the end throws.
+   class StateWriter
+   {
+      public:
+         StateWriter(void* data, std::size_t size)
+            : data(static_cast<std::uint8_t*>(data)), size(size), offset(0) {}
+
+         void u8(std::uint8_t val) { *take(1) = val; }
+
+         void u16(std::uint16_t val)
+         {
+            auto ptr = take(2);
+            ptr[0] = std::uint8_t(val >> 0);
+            ptr[1] = std::uint8_t(val >> 8);
+         }
+
+         void u32(std::uint32_t val)
+         {
+            u16(std::uint16_t(val >>  0));
+            u16(std::uint16_t(val >> 16));
+         }
+
+         void i32(std::int32_t val) { u32(std::uint32_t(val)); }
+         void boolean(bool val) { u8(val); }
+         void pos(Pos pos) { i32(pos.x); i32(pos.y); }
+
+         void bytes(const void* src, std::size_t len)
+         {
+            std::memcpy(take(len), src, len);
+         }
+
+         // Zeroes whatever is left, so every state has the same size.
+         void pad()
+         {
+            std::memset(data + offset, 0, size - offset);
+            offset = size;
+         }
+
+         std::size_t tell() const { return offset; }
+
+      private:
+         std::uint8_t* data;
+         std::size_t size;
+         std::size_t offset;
+
+         std::uint8_t* take(std::size_t bytes)
+         {
+            if (bytes > size - offset)
+               throw std::logic_error("Savestate buffer is too small.");
+
+            auto ptr = data + offset;
+            offset += bytes;
+            return ptr;
+         }
+   };
+
+   // Counterpart of StateWriter. Reading past the end throws.
+   class StateReader
+   {
+      public:
+         StateReader(const void* data, std::size_t size)
+            : data(static_cast<const std::uint8_t*>(data)), size(size), offset(0) {}
+
+         std::uint8_t u8() { return *take(1); }
+         std::uint16_t u16() { return Utils::read_le16(take(2)); }
+         std::uint32_t u32() { return Utils::read_le32(take(4)); }
+         std::int32_t i32() { return std::int32_t(u32()); }
+         bool boolean() { return u8(); }
+
+         Pos pos()
+         {
+            int x = i32();
+            int y = i32();
+            return {x, y};
+         }
+
+         void bytes(void* dst, std::size_t len)
+         {
+            std::memcpy(dst, take(len), len);
+         }
+
+      private:
+         const std::uint8_t* data;
+         std::size_t size;
+         std::size_t offset;
+
+         const std::uint8_t* take(std::size_t bytes)
+         {
+            if (bytes > size - offset)
+               throw std::runtime_error("Savestate is truncated.");
+
+            auto ptr = data + offset;
+            offset += bytes;
+            return ptr;
+         }
+   };
+}
+
+#endif
+
@@ -2,6 +2,8 @@
 #include <stdexcept>
 #include <utility>
 #include <memory>
+#include <mutex>
+#include <map>
 
 using namespace std;
 
@@ -9,14 +11,15 @@ namespace Blit
 {
    Surface::Surface(Pixel pix, int width, int height)
       : data(make_shared<Data>(pix, width, height)),
-      m_active_alt_index(0), m_rect({0, 0}, width, height), m_ignore_camera(false)
+      m_active_alt(0), m_active_alt_index(0), m_rect({0, 0}, width, height), m_ignore_camera(false)
    {}
 
    Surface::Surface(shared_ptr<const Data> data)
-      : data(data), m_active_alt_index(0), m_rect({0, 0}, data->w, data->h), m_ignore_camera(false)
+      : data(data), m_active_alt(0), m_active_alt_index(0), m_rect({0, 0}, data->w, data->h), m_ignore_camera(false)
    {}
 
-   Surface::Surface(const vector<Alt>& alts, const string& start_id) : m_ignore_camera(false)
+   Surface::Surface(const vector<Alt>& alts, const string& start_id)
+      : m_active_alt(0), m_active_alt_index(0), m_ignore_camera(false)
    {
       if (alts.empty())
          throw logic_error("Alts is empty.");
@@ -31,27 +34,60 @@ namespace Blit
       if (!same_size)
          throw logic_error("Not all alts are of same size.");
 
+      // Frames of an alt keep their order in the sprite.
+      auto table = make_shared<AltTable>();
+      vector<vector<shared_ptr<const Data>>> frames;
       for (auto& alt : alts)
-         this->alts.insert({alt.tag, alt.data});
-
+      {
+         unsigned id = alt_id(alt.tag);
+         if (id >= frames.size())
+            frames.resize(id + 1);
+         frames[id].push_back(alt.data);
+      }
+
+      table->ranges.resize(frames.size());
+      for (unsigned id = 0; id < frames.size(); id++)
+      {
+         table->ranges[id] = {unsigned(table->frames.size()), unsigned(frames[id].size())};
+         table->frames.insert(end(table->frames), begin(frames[id]), end(frames[id]));
+      }
+
+      this->alts = move(table);
       active_alt(start_id);
    }
 
-   void Surface::active_alt(const string& id, unsigned index)
+   unsigned Surface::alt_id(const string& name)
    {
-      auto itr = alts.equal_range(id);
-      auto dist = distance(itr.first, itr.second);
-      if (dist <= static_cast<int>(index))
-         throw logic_error(Utils::join("Subindex is out of bounds. Requested Alt: \"", id, "\" Index: ", index));
+      static mutex lock;
+      static map<string, unsigned> ids;
+
+      lock_guard<mutex> guard{lock};
+      auto itr = ids.find(name);
+      if (itr != end(ids))
+         return itr->second;
 
-      advance(itr.first, index);
-      auto ptr = itr.first->second;
-      if (!ptr)
+      unsigned id = ids.size();
+      ids[name] = id;
+      return id;
+   }
+
+   bool Surface::has_alt(unsigned id, unsigned index) const
+   {
+      return alts && id < alts->ranges.size() && index < alts->ranges[id].count;
+   }
+
+   void Surface::active_alt(unsigned id, unsigned index)
+   {
+      if (!has_alt(id))
          throw logic_error(Utils::join("Alt ID ", id, " does not exist."));
 
+      auto& range = alts->ranges[id];
+      if (index >= range.count)
+         throw logic_error(Utils::join("Subindex is out of bounds. Requested Alt: ", id, " Index: ", index));
+
       m_active_alt = id;
       m_active_alt_index = index;
-      data = ptr;
+      data = alts->frames[range.first + index];
    }
 
    void Surface::active_alt_index(unsigned index)
@@ -60,11 +96,15 @@ namespace Blit
    }
 
    Surface::Surface()
-      : m_rect({0, 0}, 0, 0), m_ignore_camera(false)
+      : m_active_alt(0), m_active_alt_index(0), m_rect({0, 0}, 0, 0), m_ignore_camera(false)
    {}
 
    Surface Surface::sub(Rect rect) const
    {
+      if (rect && (rect & Rect{{0, 0}, data->w, data->h}) == rect)
+         return {make_shared<Data>(data, rect)};
+
+      // Partially outside, pad with transparent pixels.
       RenderTarget target(rect.w, rect.h);
       Surface surf{*this};
       surf.rect().pos = -rect.pos;
@@ -80,10 +120,12 @@ namespace Blit
       if (x >= data->w || y >= data->h)
          return 0;
 
-      return data->pixels[y * data->w + x];
+      if (data->indices)
+         return (*data->palette)[data->indices[y * data->stride + x]];
+      return data->pixels[y * data->stride + x];
    }
 
-   const Pixel* Surface::pixel_raw(Pos pos) const
+   int Surface::offset(Pos pos) const
    {
       pos -= m_rect.pos;
       int x = pos.x, y = pos.y;
@@ -95,22 +137,52 @@ namespace Blit
                   "Real dimension: (", data->w, ", ", data->h, ")."
                   ));
 
-      return &data->pixels[y * data->w + x];
+      return y * data->stride + x;
+   }
+
+   const Pixel* Surface::pixel_raw(Pos pos) const
+   {
+      if (!data->pixels)
+         throw logic_error("Surface is indexed.");
+      return data->pixels + offset(pos);
+   }
+
+   const uint8_t* Surface::index_raw(Pos pos) const
+   {
+      if (!data->indices)
+         throw logic_error("Surface is not indexed.");
+      return data->indices + offset(pos);
    }
 
    void Surface::refill_color(Pixel pixel)
    {
+      if (data->indices)
+      {
+         auto palette = make_shared<Palette>(*data->palette);
+         refill_palette(*palette, pixel);
+         set_palette(move(palette));
+         return;
+      }
+
       vector<Pixel> pix;
       pix.reserve(data->w * data->h);
 
-      auto& orig = data->pixels;
-      transform(begin(orig), end(orig), back_inserter(pix), [pixel](Pixel old) {
-            return old & static_cast<Pixel>(Pixel::alpha_mask) ? pixel : Pixel();
-         });
+      for (int y = 0; y < data->h; y++)
+      {
+         auto line = data->pixels + y * data->stride;
+         transform(line, line + data->w, back_inserter(pix), [pixel](Pixel old) {
+               return old & static_cast<Pixel>(Pixel::alpha_mask) ? pixel : Pixel();
+            });
+      }
 
       data = make_shared<Surface::Data>(move(pix), data->w, data->h);
    }
 
+   void Surface::set_palette(shared_ptr<const Palette> palette)
+   {
+      data = make_shared<Surface::Data>(data, move(palette));
+   }
+
    void Surface::ignore_camera(bool ignore)
    {
       m_ignore_camera = ignore;
@@ -122,13 +194,50 @@ namespace Blit
    }
 
    Surface::Data::Data(vector<Pixel> pixels, int w, int h)
-      : pixels(move(pixels)), w(w), h(h)
+      : storage(move(pixels)), pixels(storage.data()), indices(nullptr), w(w), h(h), stride(w)
    {}
 
    Surface::Data::Data(Pixel pixel, int w, int h)
-      : pixels(w * h)
+      : storage(w * h, pixel), pixels(storage.data()), indices(nullptr), w(w), h(h), stride(w)
+   {}
+
+   Surface::Data::Data(const Pixel* pixels, int w, int h, shared_ptr<const void> backing)
+      : backing(move(backing)), pixels(pixels), indices(nullptr), w(w), h(h), stride(w)
+   {}
+
+   Surface::Data::Data(vector<uint8_t> indices, shared_ptr<const Palette> palette, int w, int h)
+      : index_storage(move(indices)), pixels(nullptr), indices(index_storage.data()),
+      palette(move(palette)), w(w), h(h), stride(w)
+   {}
+
+   Surface::Data::Data(const uint8_t* indices, shared_ptr<const Palette> palette, int w, int h,
+         shared_ptr<const void> backing)
+      : backing(move(backing)), pixels(nullptr), indices(indices),
+      palette(move(palette)), w(w), h(h), stride(w)
+   {}
+
+   Surface::Data::Data(shared_ptr<const Data> parent, Rect rect)
+      : pixels(nullptr), indices(nullptr), palette(parent->palette),
+      w(rect.w), h(rect.h), stride(parent->stride)
+   {
+      if (!rect || (rect & Rect{{0, 0}, parent->w, parent->h}) != rect)
+         throw logic_error("Sub-surface is out of bounds.");
+
+      int offset = rect.pos.y * stride + rect.pos.x;
+      if (parent->indices)
+         indices = parent->indices + offset;
+      else
+         pixels  = parent->pixels + offset;
+      backing = move(parent);
+   }
+
+   Surface::Data::Data(shared_ptr<const Data> parent, shared_ptr<const Palette> palette)
+      : pixels(nullptr), indices(parent->indices), palette(move(palette)),
+      w(parent->w), h(parent->h), stride(parent->stride)
    {
-      fill(begin(pixels), end(pixels), pixel);
+      if (!indices)
+         throw logic_error("Palette given for a surface which is not indexed.");
+      backing = move(parent);
    }
 }
 
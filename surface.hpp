@@ -2,6 +2,7 @@
 #define SURFACE_HPP__
 
 #include "blit.hpp"
+#include "palette.hpp"
 
 #include <memory>
 #include <vector>
@@ -18,9 +19,28 @@ namespace Blit
          {
             Data(std::vector<Pixel> pixels, int w, int h);
             Data(Pixel pixel, int w, int h);
-
-            std::vector<Pixel> pixels;
+            // Borrows pixels owned by someone else, e.g. a mapped AssetPack.
+            Data(const Pixel* pixels, int w, int h, std::shared_ptr<const void> backing);
+            // Indexed pixels, expanded through palette when blitted.
+            Data(std::vector<std::uint8_t> indices, std::shared_ptr<const Palette> palette, int w, int h);
+            Data(const std::uint8_t* indices, std::shared_ptr<const Palette> palette, int w, int h,
+                  std::shared_ptr<const void> backing);
+            // View of a rect inside parent, sharing its pixels and stride.
+            Data(std::shared_ptr<const Data> parent, Rect rect);
+            // The indices of parent, seen through another palette.
+            Data(std::shared_ptr<const Data> parent, std::shared_ptr<const Palette> palette);
+
+            Data(const Data&) = delete;
+            Data& operator=(const Data&) = delete;
+
+            std::vector<Pixel> storage;
+            std::vector<std::uint8_t> index_storage;
+            std::shared_ptr<const void> backing;
+            const Pixel* pixels;          // nullptr if indexed.
+            const std::uint8_t* indices;  // nullptr unless indexed.
+            std::shared_ptr<const Palette> palette;
             int w, h;
+            int stride; // In pixels.
          };
 
          struct Alt
@@ -38,9 +58,14 @@ namespace Blit
          Surface(Surface&&) = default;
          Surface& operator=(Surface&&) = default;
 
+         // Shares pixels with this surface where rect is inside it.
          Surface sub(Rect rect) const;
          void refill_color(Pixel pix);
 
+         // Indexed surfaces only.
+         const std::shared_ptr<const Palette>& palette() const { return data->palette; }
+         void set_palette(std::shared_ptr<const Palette> palette);
+
          Rect& rect() { return m_rect; }
          const Rect& rect() const { return m_rect; }
 
@@ -49,9 +74,18 @@ namespace Blit
 
          Pixel pixel(Pos pos) const;
          const Pixel* pixel_raw(Pos pos) const;
-
-         std::pair<std::string, unsigned> active_alt() const { return { m_active_alt, m_active_alt_index }; }
-         void active_alt(const std::string& id, unsigned index = 0);
+         const std::uint8_t* index_raw(Pos pos) const;
+         int stride() const { return data->stride; }
+
+         // Alt names are interned to small integers shared by all sprites,
+         // so look them up once and switch frames by ID afterwards.
+         static unsigned alt_id(const std::string& name);
+         bool has_alt(unsigned id, unsigned index = 0) const;
+
+         unsigned active_alt() const { return m_active_alt; }
+         unsigned active_alt_index() const { return m_active_alt_index; }
+         void active_alt(unsigned id, unsigned index = 0);
+         void active_alt(const std::string& id, unsigned index = 0) { active_alt(alt_id(id), index); }
          void active_alt_index(unsigned index);
 
          std::map<std::string, std::string>& attr() { return attribs; }
@@ -59,9 +93,20 @@ namespace Blit
 
       private:
          std::shared_ptr<const Data> data;
+         int offset(Pos pos) const;
 
-         std::multimap<std::string, std::shared_ptr<const Data>> alts;
-         std::string m_active_alt;
+         // Frames of every alt, grouped by alt. Shared by all copies of a sprite.
+         struct AltTable
+         {
+            struct Range
+            {
+               unsigned first, count;
+            };
+            std::vector<Range> ranges; // Indexed by alt ID.
+            std::vector<std::shared_ptr<const Data>> frames;
+         };
+         std::shared_ptr<const AltTable> alts;
+         unsigned m_active_alt;
          unsigned m_active_alt_index;
 
          std::map<std::string, std::string> attribs;
@@ -117,6 +162,7 @@ namespace Blit
 
       private:
          std::map<std::string, std::shared_ptr<const Surface::Data>> cache;
+         std::shared_ptr<const Surface::Data> cached_image(const std::string& path);
          std::shared_ptr<const Surface::Data> load_image(const std::string& path);
    };
 
@@ -1,45 +1,85 @@
 #include "surface.hpp"
-#include "pugixml/pugixml.hpp"
+#include "asset_pack.hpp"
+#include "atlas.hpp"
+#include "xml_document.hpp"
 #include "rpng.h"
 #include <stdexcept>
 #include <stdio.h>
 #include <new>
 
-using namespace pugi;
-
 namespace Blit
 {
    Surface SurfaceCache::from_image(const std::string& path)
    {
-      auto ptr = cache[path];
+      return {cached_image(path)};
+   }
+
+   std::shared_ptr<const Surface::Data> SurfaceCache::cached_image(const std::string& path)
+   {
+      auto& ptr = cache[path];
       if (ptr)
-         return {ptr};
-      
-      cache[path] = load_image(path);
-      return cache[path];
+         return ptr;
+
+      auto& atlas = get_atlas();
+      ptr = atlas.find(path);
+      if (!ptr)
+      {
+         auto image = load_image(path);
+         ptr = atlas.insert(path, *image);
+         if (!ptr)
+            ptr = std::move(image);
+      }
+
+      return ptr;
+   }
+
+   static std::shared_ptr<const Surface::Data> sheet_face(std::shared_ptr<const Surface::Data> sheet, Rect rect)
+   {
+      if (!rect || (rect & Rect{{0, 0}, sheet->w, sheet->h}) != rect)
+         throw std::logic_error("Sprite face is outside the sprite sheet.");
+
+      return std::make_shared<Surface::Data>(std::move(sheet), rect);
    }
 
+   // Faces either have their own image (source), or are a rect (x, y, width, height)
+   // inside a sprite sheet given by the sprite's source. Face width and height
+   // default to those of the sprite.
    Surface SurfaceCache::from_sprite(const std::string& path)
    {
-      xml_document doc;
-      if (!doc.load_file(path.c_str()))
+      XMLDocument doc;
+      if (!doc.load(path))
          throw std::runtime_error(Utils::join("Failed to load XML sprite: ", path, "."));
 
       auto basedir = Utils::basedir(path);
       std::vector<Surface::Alt> alts;
 
       auto sprite = doc.child("sprite");
+
+      std::shared_ptr<const Surface::Data> sheet;
+      auto sheet_source = sprite.attribute("source").value();
+      if (*sheet_source)
+         sheet = cached_image(Utils::join(basedir, "/", sheet_source));
+
+      int face_width  = sprite.attribute("width").as_int();
+      int face_height = sprite.attribute("height").as_int();
+
       for (auto face = sprite.child("face"); face; face = face.next_sibling())
       {
-         auto id = face.attribute("id").value();
-         auto path   = Utils::join(basedir, "/", face.attribute("source").value());
+         auto id     = face.attribute("id").value();
+         auto source = face.attribute("source").value();
 
-         auto ptr = cache[path];
-         if (!ptr)
+         std::shared_ptr<const Surface::Data> ptr;
+         if (*source)
+            ptr = cached_image(Utils::join(basedir, "/", source));
+         else if (sheet)
          {
-            cache[path] = load_image(path);
-            ptr = cache[path];
+            Rect rect{{face.attribute("x").as_int(), face.attribute("y").as_int()},
+               face.attribute("width").as_int(face_width),
+               face.attribute("height").as_int(face_height)};
+            ptr = sheet_face(sheet, rect);
          }
+         else
+            throw std::logic_error(Utils::join("Sprite face \"", id, "\" has no image: ", path, "."));
 
          alts.push_back(Surface::Alt{ptr, id});
       }
@@ -49,6 +89,24 @@ namespace Blit
 
    std::shared_ptr<const Surface::Data> SurfaceCache::load_image(const std::string& path)
    {
+      // Pre-decoded pixels in the asset pack are used in-place.
+      AssetPack::Blob blob;
+      if (get_asset_pack().find(path, AssetPack::Type::IndexedImage, blob) &&
+            blob.size == sizeof(Palette) + std::size_t(blob.width) * blob.height)
+      {
+         auto bytes = static_cast<const uint8_t*>(blob.data);
+         std::shared_ptr<const Palette> palette{blob.owner, reinterpret_cast<const Palette*>(bytes)};
+         return std::make_shared<Surface::Data>(bytes + sizeof(Palette), std::move(palette),
+               blob.width, blob.height, std::move(blob.owner));
+      }
+
+      if (get_asset_pack().find(path, AssetPack::Type::Image, blob) &&
+            blob.size == std::size_t(blob.width) * blob.height * sizeof(Pixel))
+      {
+         return std::make_shared<Surface::Data>(static_cast<const Pixel*>(blob.data),
+               blob.width, blob.height, std::move(blob.owner));
+      }
+
       uint32_t *image = nullptr;
       unsigned width = 0, height = 0;
       bool loaded = rpng_load_image_argb(path.c_str(), &image, &width, &height);
@@ -67,6 +125,13 @@ namespace Blit
       }
 
       free(image);
+
+      // Most art only uses a handful of colors.
+      auto palette = std::make_shared<Palette>();
+      std::vector<uint8_t> indices;
+      if (index_pixels(pix.data(), pix.size(), *palette, indices))
+         return std::make_shared<Surface::Data>(std::move(indices), std::move(palette), width, height);
+
       return std::make_shared<Surface::Data>(std::move(pix), width, height);
    }
 }
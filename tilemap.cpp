@@ -1,4 +1,5 @@
 #include "tilemap.hpp"
+#include "asset_pack.hpp"
 #include "utils.hpp"
 
 #include <iostream>
@@ -6,64 +7,65 @@
 #include <map>
 #include <utility>
 #include <string>
-#include "pugixml/pugixml.hpp"
-
-using namespace pugi;
 
 namespace Blit
 {
-   Tilemap::Tilemap(const std::string& path) : dir(Utils::basedir(path))
-   {
-      xml_document doc;
-      if (!doc.load_file(path.c_str()))
-         throw std::runtime_error(Utils::join("Failed to load XML map: ", path, "."));
+   Tilemap::Tilemap(const std::string& path)
+      : Tilemap(load_data(path), Utils::basedir(path))
+   {}
 
-      auto map   = doc.child("map");
-      width      = map.attribute("width").as_int();
-      height     = map.attribute("height").as_int();
-      tilewidth  = map.attribute("tilewidth").as_int();
-      tileheight = map.attribute("tileheight").as_int();
+   Tilemap::Tilemap(const TilemapData& data, const std::string& dir) : dir(dir)
+   {
+      width      = data.width;
+      height     = data.height;
+      tilewidth  = data.tilewidth;
+      tileheight = data.tileheight;
 
       if (!width || !height || !tilewidth || !tileheight)
          throw std::logic_error("Tilemap is malformed.");
 
       std::map<unsigned, Surface> tiles;
-      for (auto set = map.child("tileset"); set; set = set.next_sibling("tileset"))
+      for (auto& set : data.tilesets)
          add_tileset(tiles, set);
 
-      for (auto layer = map.child("layer"); layer; layer = layer.next_sibling("layer"))
+      for (auto& layer : data.layers)
          add_layer(tiles, layer, tilewidth, tileheight);
    }
 
-   std::map<std::string, std::string> Tilemap::get_attributes(xml_node parent, const std::string& child) const
+   // Prefers a compiled level from the asset pack, then a compiled .lvl file,
+   // and only parses TMX if neither is available.
+   TilemapData Tilemap::load_data(const std::string& path)
    {
-      std::map<std::string, std::string> attrs;
+      AssetPack::Blob blob;
+      if (get_asset_pack().find(path, AssetPack::Type::Level, blob))
+         return TilemapData::from_binary(static_cast<const std::uint8_t*>(blob.data), blob.size);
 
-      for (auto node = parent.child(child.c_str()); node; node = node.next_sibling(child.c_str()))
+      auto ext = path.find_last_of('.');
+      if (ext != std::string::npos && Utils::tolower(path.substr(ext)) == ".lvl")
       {
-         auto name = node.attribute("name").value();
-         auto value = node.attribute("value").value();
-         attrs.insert({name, value});
+         auto file = MappedFile::open(path);
+         if (!file)
+            throw std::runtime_error(Utils::join("Failed to load compiled map: ", path, "."));
+
+         return TilemapData::from_binary(file->data(), file->size());
       }
 
-      return attrs;
+      return TilemapData::from_tmx(path);
    }
 
-   void Tilemap::add_tileset(std::map<unsigned, Surface>& tiles, xml_node node)
+   void Tilemap::add_tileset(std::map<unsigned, Surface>& tiles, const TilemapData::Tileset& set)
    {
-      int first_gid  = node.attribute("firstgid").as_int();
-      int id_cnt     = 0;
-      int tilewidth  = node.attribute("tilewidth").as_int();
-      int tileheight = node.attribute("tileheight").as_int();
+      unsigned first_gid = set.first_gid;
+      int id_cnt         = 0;
+      int tilewidth      = set.tilewidth;
+      int tileheight     = set.tileheight;
 
-      auto image     = node.child("image");
-      auto source    = image.attribute("source").value();
-      int width      = image.attribute("width").as_int();
-      int height     = image.attribute("height").as_int();
+      auto& source       = set.source;
+      int width          = set.width;
+      int height         = set.height;
 
 #if 0
       std::cerr << "Adding tileset:" <<
-         " Name: " << node.attribute("name").value() <<
          " Gid: " << first_gid <<
          " Tilewidth: " << tilewidth <<
          " Tileheight: " << tileheight <<
@@ -81,7 +83,7 @@ namespace Blit
       if (surf.rect().w != width || surf.rect().h != height)
          throw std::logic_error("Tilemap geometry does not correspond with image values.");
 
-      auto global_attr = get_attributes(node.child("properties"), "property");
+      auto& global_attr = set.attr;
 
 #if 0
       std::cerr << "Dumping attrs:" << std::endl;
@@ -94,18 +96,18 @@ namespace Blit
       {
          for (int x = 0; x < width; x += tilewidth, id_cnt++)
          {
-            int id = first_gid + id_cnt;
+            unsigned id = first_gid + id_cnt;
             tiles[id] = surf.sub({{x, y}, tilewidth, tileheight});
             std::copy(std::begin(global_attr), std::end(global_attr), std::inserter(tiles[id].attr(), std::begin(tiles[id].attr()))); 
          }
       }
 
       // Load all attributes for a tile into the surface.
-      for (auto tile = node.child("tile"); tile; tile = tile.next_sibling("tile"))
+      for (auto& tile : set.tiles)
       {
-         int id = first_gid + tile.attribute("id").as_int();
+         unsigned id = first_gid + tile.first;
 
-         auto attrs = get_attributes(tile.child("properties"), "property");
+         auto attrs = tile.second;
          std::copy(std::begin(global_attr), std::end(global_attr), std::inserter(attrs, std::begin(attrs)));
 
          auto itr = attrs.find("sprite");
@@ -117,30 +119,28 @@ namespace Blit
       }
    }
 
-   void Tilemap::add_layer(std::map<unsigned, Surface>& tiles, xml_node node,
+   void Tilemap::add_layer(std::map<unsigned, Surface>& tiles, const TilemapData::Layer& data,
          int tilewidth, int tileheight)
    {
       Layer layer;
-      int width  = node.attribute("width").as_int();
-      int height = node.attribute("height").as_int();
+      int width  = data.width;
+      int height = data.height;
 
       if (!width || !height)
          throw std::logic_error("Layer is empty.");
 
 #if 0
       std::cerr << "Adding layer:" <<
-         " Name: " << node.attribute("name").value() <<
+         " Name: " << data.name <<
          " Width: " << width <<
          " Height: " << height << std::endl;
 #endif
 
-      Utils::xml_node_walker walk{node.child("data"), "tile", "gid"};
       int index = 0;
-      for (auto& gid_str : walk)
+      for (auto gid : data.gids)
       {
          Pos pos = {index % width, index / width};
 
-         unsigned gid = Utils::stoi(gid_str);
          if (gid)
          {
             auto& surf = tiles[gid];
@@ -155,8 +155,8 @@ namespace Blit
          index++;
       }
 
-      layer.attr = get_attributes(node.child("properties"), "property");
-      layer.name = node.attribute("name").value();
+      layer.attr = data.attr;
+      layer.name = data.name;
       m_layers.push_back(std::move(layer));
    }
 
@@ -2,7 +2,7 @@
 #define TILEMAP_HPP__
 
 #include "surface.hpp"
-#include "pugixml/pugixml.hpp"
+#include "tilemap_data.hpp"
 
 #include <string>
 #include <set>
@@ -22,6 +22,7 @@ namespace Blit
 
          Tilemap() = default;
          Tilemap(const std::string& path);
+         Tilemap(const TilemapData& data, const std::string& dir);
          Tilemap(Tilemap&&) = default;
          Tilemap& operator=(Tilemap&&) = default;
 
@@ -57,12 +58,12 @@ namespace Blit
          int width, height, tilewidth, tileheight;
          std::string dir;
 
+         static TilemapData load_data(const std::string& path);
+
          void add_tileset(std::map<unsigned, Surface>& tiles,
-               pugi::xml_node node);
+               const TilemapData::Tileset& set);
          void add_layer(std::map<unsigned, Surface>& tiles,
-               pugi::xml_node node, int tilewidth, int tileheight);
-
-         std::map<std::string, std::string> get_attributes(pugi::xml_node, const std::string& child) const;
+               const TilemapData::Layer& data, int tilewidth, int tileheight);
    };
 }
 
@@ -0,0 +1,489 @@
+#include "tilemap_data.hpp"
+#include "utils.hpp"
+#include "xml_document.hpp"
+
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <zlib.h>
+
+using namespace pugi;
+using namespace std;
+
+namespace Blit
+{
+   const char TilemapData::magic[8] = { 'D', 'I', 'N', 'O', 'L', 'V', 'L', '\0' };
+
+   static TilemapData::Attributes get_attributes(xml_node parent, const char *child)
+   {
+      TilemapData::Attributes attrs;
+
+      for (auto node = parent.child(child); node; node = node.next_sibling(child))
+      {
+         auto name = node.attribute("name").value();
+         auto value = node.attribute("value").value();
+         attrs.insert({name, value});
+      }
+
+      return attrs;
+   }
+
+   // Tiled stores flipping in the upper bits of a GID. We don't support flipping, so drop them.
+   static const unsigned gid_flip_mask = 0xe0000000u;
+
+   static void decode_csv(const char *text, vector<unsigned>& gids)
+   {
+      while (*text)
+      {
+         char *next = nullptr;
+         unsigned long gid = strtoul(text, &next, 10);
+         if (next == text)
+         {
+            // Skip whitespace and separators between numbers.
+            if (*text != ',' && !isspace(static_cast<unsigned char>(*text)))
+               throw runtime_error("Invalid CSV layer data.");
+            text++;
+            continue;
+         }
+
+         gids.push_back(gid & ~gid_flip_mask);
+         text = next;
+      }
+   }
+
+   static vector<uint8_t> decode_base64(const char *text)
+   {
+      static const auto lut = [] {
+         array<int8_t, 256> lut;
+         lut.fill(-1);
+         const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+         for (int i = 0; i < 64; i++)
+            lut[static_cast<uint8_t>(chars[i])] = i;
+         return lut;
+      }();
+
+      vector<uint8_t> out;
+      out.reserve(strlen(text) * 3 / 4);
+
+      uint32_t accum = 0;
+      unsigned bits = 0;
+      for (; *text && *text != '='; text++)
+      {
+         int val = lut[static_cast<uint8_t>(*text)];
+         if (val < 0)
+         {
+            if (isspace(static_cast<unsigned char>(*text)))
+               continue;
+            throw runtime_error("Invalid base64 layer data.");
+         }
+
+         accum = (accum << 6) | val;
+         bits += 6;
+         if (bits >= 8)
+         {
+            bits -= 8;
+            out.push_back(uint8_t(accum >> bits));
+         }
+      }
+
+      return out;
+   }
+
+   // Handles both zlib and gzip streams.
+   static vector<uint8_t> inflate_data(const vector<uint8_t>& in, size_t size)
+   {
+      vector<uint8_t> out(size);
+
+      z_stream stream{};
+      if (inflateInit2(&stream, 15 + 32) != Z_OK)
+         throw runtime_error("Failed to initialize zlib.");
+
+      stream.next_in   = const_cast<Bytef*>(in.data());
+      stream.avail_in  = in.size();
+      stream.next_out  = out.data();
+      stream.avail_out = out.size();
+
+      int ret = inflate(&stream, Z_FINISH);
+      inflateEnd(&stream);
+
+      if (ret != Z_STREAM_END || stream.avail_out)
+         throw runtime_error("Failed to inflate layer data.");
+
+      return out;
+   }
+
+   // Decodes any of the layer data formats Tiled writes, straight into a GID array.
+   static void read_layer_data(xml_node data, TilemapData::Layer& layer)
+   {
+      size_t count = size_t(layer.width) * layer.height;
+      layer.gids.reserve(count);
+
+      const char *encoding    = data.attribute("encoding").value();
+      const char *compression = data.attribute("compression").value();
+
+      if (!*encoding)
+      {
+         for (auto tile = data.child("tile"); tile; tile = tile.next_sibling("tile"))
+            layer.gids.push_back(tile.attribute("gid").as_uint() & ~gid_flip_mask);
+      }
+      else if (!strcmp(encoding, "csv"))
+         decode_csv(data.child_value(), layer.gids);
+      else if (!strcmp(encoding, "base64"))
+      {
+         auto bytes = decode_base64(data.child_value());
+         if (!strcmp(compression, "zlib") || !strcmp(compression, "gzip"))
+            bytes = inflate_data(bytes, count * 4);
+         else if (*compression)
+            throw runtime_error(Utils::join("Unsupported layer compression: ", compression, "."));
+
+         if (bytes.size() != count * 4)
+            throw runtime_error("Base64 layer data does not match layer dimensions.");
+
+         for (size_t i = 0; i < count; i++)
+            layer.gids.push_back(Utils::read_le32(&bytes[4 * i]) & ~gid_flip_mask);
+      }
+      else
+         throw runtime_error(Utils::join("Unsupported layer encoding: ", encoding, "."));
+   }
+
+   TilemapData TilemapData::from_tmx(const string& path)
+   {
+      XMLDocument doc;
+      if (!doc.load(path))
+         throw runtime_error(Utils::join("Failed to load XML map: ", path, "."));
+
+      TilemapData data;
+      auto map        = doc.child("map");
+      data.width      = map.attribute("width").as_int();
+      data.height     = map.attribute("height").as_int();
+      data.tilewidth  = map.attribute("tilewidth").as_int();
+      data.tileheight = map.attribute("tileheight").as_int();
+
+      for (auto node = map.child("tileset"); node; node = node.next_sibling("tileset"))
+      {
+         Tileset set;
+         set.first_gid  = node.attribute("firstgid").as_uint();
+         set.tilewidth  = node.attribute("tilewidth").as_int();
+         set.tileheight = node.attribute("tileheight").as_int();
+
+         auto image = node.child("image");
+         set.source = image.attribute("source").value();
+         set.width  = image.attribute("width").as_int();
+         set.height = image.attribute("height").as_int();
+         set.attr   = get_attributes(node.child("properties"), "property");
+
+         for (auto tile = node.child("tile"); tile; tile = tile.next_sibling("tile"))
+            set.tiles.push_back({tile.attribute("id").as_uint(), get_attributes(tile.child("properties"), "property")});
+
+         data.tilesets.push_back(move(set));
+      }
+
+      for (auto node = map.child("layer"); node; node = node.next_sibling("layer"))
+      {
+         Layer layer;
+         layer.name   = node.attribute("name").value();
+         layer.width  = node.attribute("width").as_int();
+         layer.height = node.attribute("height").as_int();
+         layer.attr   = get_attributes(node.child("properties"), "property");
+
+         read_layer_data(node.child("data"), layer);
+
+         data.layers.push_back(move(layer));
+      }
+
+      return data;
+   }
+
+   namespace
+   {
+      class Writer
+      {
+         public:
+            void u16(uint16_t val)
+            {
+               buffer.push_back(uint8_t(val >> 0));
+               buffer.push_back(uint8_t(val >> 8));
+            }
+
+            void u32(uint32_t val)
+            {
+               u16(uint16_t(val >>  0));
+               u16(uint16_t(val >> 16));
+            }
+
+            void string(const std::string& str) { u32(intern(str)); }
+
+            void attributes(const TilemapData::Attributes& attrs)
+            {
+               u32(attrs.size());
+               for (auto& attr : attrs)
+               {
+                  string(attr.first);
+                  string(attr.second);
+               }
+            }
+
+            void align()
+            {
+               while (buffer.size() & 3)
+                  buffer.push_back(0);
+            }
+
+            vector<uint8_t> finish(const TilemapData::Header& header)
+            {
+               Writer head;
+               for (auto c : header.magic)
+                  head.buffer.push_back(uint8_t(c));
+               head.u32(header.version);
+               head.u32(header.width);
+               head.u32(header.height);
+               head.u32(header.tilewidth);
+               head.u32(header.tileheight);
+               head.u32(header.num_tilesets);
+               head.u32(header.num_layers);
+               vector<uint8_t> out = move(head.buffer);
+
+               Writer table;
+               table.u32(strings.size());
+               for (auto& str : strings)
+               {
+                  table.u32(str.size());
+                  table.buffer.insert(end(table.buffer), begin(str), end(str));
+               }
+               table.align();
+
+               out.insert(end(out), begin(table.buffer), end(table.buffer));
+               out.insert(end(out), begin(buffer), end(buffer));
+               return out;
+            }
+
+         private:
+            vector<uint8_t> buffer;
+            vector<std::string> strings;
+            map<std::string, uint32_t> interned;
+
+            uint32_t intern(const std::string& str)
+            {
+               auto itr = interned.find(str);
+               if (itr != end(interned))
+                  return itr->second;
+
+               uint32_t index = strings.size();
+               strings.push_back(str);
+               interned[str] = index;
+               return index;
+            }
+      };
+
+      class Reader
+      {
+         public:
+            Reader(const uint8_t* data, size_t size) : data(data), size(size), offset(0) {}
+
+            uint16_t u16()
+            {
+               auto ptr = take(2);
+               return Utils::read_le16(ptr);
+            }
+
+            uint32_t u32()
+            {
+               auto ptr = take(4);
+               return Utils::read_le32(ptr);
+            }
+
+            const uint8_t* take(size_t bytes)
+            {
+               if (bytes > size - offset)
+                  throw runtime_error("Compiled level is truncated.");
+
+               auto ptr = data + offset;
+               offset += bytes;
+               return ptr;
+            }
+
+            size_t remaining() const { return size - offset; }
+
+            void align()
+            {
+               take((4 - (offset & 3)) & 3);
+            }
+
+            TilemapData::Header header()
+            {
+               TilemapData::Header header;
+               memcpy(header.magic, take(sizeof(header.magic)), sizeof(header.magic));
+               header.version      = u32();
+               header.width        = u32();
+               header.height       = u32();
+               header.tilewidth    = u32();
+               header.tileheight   = u32();
+               header.num_tilesets = u32();
+               header.num_layers   = u32();
+               return header;
+            }
+
+            void read_strings()
+            {
+               uint32_t count = u32();
+               if (count > size - offset)
+                  throw runtime_error("Compiled level is truncated.");
+
+               strings.reserve(count);
+               for (uint32_t i = 0; i < count; i++)
+               {
+                  uint32_t len = u32();
+                  auto ptr = reinterpret_cast<const char*>(take(len));
+                  strings.emplace_back(ptr, len);
+               }
+               align();
+            }
+
+            const std::string& string()
+            {
+               uint32_t index = u32();
+               if (index >= strings.size())
+                  throw runtime_error("Compiled level has invalid string reference.");
+               return strings[index];
+            }
+
+            TilemapData::Attributes attributes()
+            {
+               TilemapData::Attributes attrs;
+               uint32_t count = u32();
+               for (uint32_t i = 0; i < count; i++)
+               {
+                  auto& name = string();
+                  auto& value = string();
+                  attrs.insert({name, value});
+               }
+               return attrs;
+            }
+
+         private:
+            const uint8_t* data;
+            size_t size;
+            size_t offset;
+            vector<std::string> strings;
+      };
+   }
+
+   vector<uint8_t> TilemapData::to_binary() const
+   {
+      Header header{};
+      memcpy(header.magic, magic, sizeof(magic));
+      header.version      = version;
+      header.width        = width;
+      header.height       = height;
+      header.tilewidth    = tilewidth;
+      header.tileheight   = tileheight;
+      header.num_tilesets = tilesets.size();
+      header.num_layers   = layers.size();
+
+      Writer writer;
+      for (auto& set : tilesets)
+      {
+         writer.u32(set.first_gid);
+         writer.u32(set.tilewidth);
+         writer.u32(set.tileheight);
+         writer.string(set.source);
+         writer.u32(set.width);
+         writer.u32(set.height);
+         writer.attributes(set.attr);
+
+         writer.u32(set.tiles.size());
+         for (auto& tile : set.tiles)
+         {
+            writer.u32(tile.first);
+            writer.attributes(tile.second);
+         }
+      }
+
+      for (auto& layer : layers)
+      {
+         if (layer.gids.size() != size_t(layer.width) * layer.height)
+            throw logic_error(Utils::join("Layer \"", layer.name, "\" does not match its dimensions."));
+
+         writer.string(layer.name);
+         writer.u32(layer.width);
+         writer.u32(layer.height);
+         writer.attributes(layer.attr);
+
+         for (auto gid : layer.gids)
+         {
+            if (gid > numeric_limits<uint16_t>::max())
+               throw logic_error(Utils::join("GID ", gid, " does not fit in a compiled level."));
+            writer.u16(gid);
+         }
+         writer.align();
+      }
+
+      return writer.finish(header);
+   }
+
+   TilemapData TilemapData::from_binary(const uint8_t* data, size_t size)
+   {
+      Reader reader{data, size};
+      auto header = reader.header();
+      if (memcmp(header.magic, magic, sizeof(magic)) || header.version != version)
+         throw runtime_error("Compiled level has invalid header.");
+
+      // Every tileset and layer takes up more than a byte, so this rejects absurd counts early.
+      if (header.num_tilesets > size || header.num_layers > size)
+         throw runtime_error("Compiled level is truncated.");
+
+      TilemapData map;
+      map.width      = header.width;
+      map.height     = header.height;
+      map.tilewidth  = header.tilewidth;
+      map.tileheight = header.tileheight;
+
+      reader.read_strings();
+
+      map.tilesets.resize(header.num_tilesets);
+      for (auto& set : map.tilesets)
+      {
+         set.first_gid  = reader.u32();
+         set.tilewidth  = reader.u32();
+         set.tileheight = reader.u32();
+         set.source     = reader.string();
+         set.width      = reader.u32();
+         set.height     = reader.u32();
+         set.attr       = reader.attributes();
+
+         uint32_t num_tiles = reader.u32();
+         for (uint32_t i = 0; i < num_tiles; i++)
+         {
+            uint32_t id = reader.u32();
+            set.tiles.push_back({id, reader.attributes()});
+         }
+      }
+
+      map.layers.resize(header.num_layers);
+      for (auto& layer : map.layers)
+      {
+         layer.name   = reader.string();
+         layer.width  = reader.u32();
+         layer.height = reader.u32();
+         layer.attr   = reader.attributes();
+
+         // Checked before sizing anything, as a corrupt width and height
+         // could overflow the byte count.
+         uint64_t count = uint64_t(layer.width) * layer.height;
+         if (count > reader.remaining() / sizeof(uint16_t))
+            throw runtime_error("Compiled level is truncated.");
+
+         auto gids = reader.take(count * sizeof(uint16_t));
+         layer.gids.resize(count);
+         for (size_t i = 0; i < count; i++)
+            layer.gids[i] = Utils::read_le16(gids + 2 * i);
+         reader.align();
+      }
+
+      return map;
+   }
+}
+
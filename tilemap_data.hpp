@@ -0,0 +1,78 @@
+#ifndef TILEMAP_DATA_HPP__
+#define TILEMAP_DATA_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Blit
+{
+   // Everything a Tilemap is built from, independent of the file it came from.
+   // Can be parsed from Tiled TMX, or from a compiled binary level which loads
+   // without any XML parsing at all.
+   //
+   // Binary layout (little-endian):
+   //    Header: char magic[8], u32 version, width, height, tilewidth, tileheight,
+   //       num_tilesets, num_layers
+   //    u32 num_strings, then num_strings times { u32 length, char[length] }
+   //    num_tilesets times:
+   //       u32 first_gid, tilewidth, tileheight, source, width, height
+   //       attributes
+   //       u32 num_tiles, then num_tiles times { u32 id, attributes }
+   //    num_layers times:
+   //       u32 name, width, height
+   //       attributes
+   //       u16 gids[width * height], padded to 4 bytes
+   //
+   // Strings are interned, and referred to by index into the string table.
+   // Attributes are stored as u32 count, then count times { u32 name, u32 value }.
+   struct TilemapData
+   {
+      typedef std::map<std::string, std::string> Attributes;
+
+      struct Tileset
+      {
+         unsigned first_gid;
+         int tilewidth, tileheight;
+         std::string source;
+         int width, height;
+         Attributes attr;
+         std::vector<std::pair<unsigned, Attributes>> tiles;
+      };
+
+      struct Layer
+      {
+         std::string name;
+         int width, height;
+         Attributes attr;
+         std::vector<unsigned> gids;
+      };
+
+      struct Header
+      {
+         char magic[8];
+         std::uint32_t version;
+         std::uint32_t width, height;
+         std::uint32_t tilewidth, tileheight;
+         std::uint32_t num_tilesets;
+         std::uint32_t num_layers;
+      };
+
+      static const char magic[8];
+      static const std::uint32_t version = 1;
+
+      int width, height, tilewidth, tileheight;
+      std::vector<Tileset> tilesets;
+      std::vector<Layer> layers;
+
+      static TilemapData from_tmx(const std::string& path);
+      static TilemapData from_binary(const std::uint8_t* data, std::size_t size);
+      std::vector<std::uint8_t> to_binary() const;
+   };
+}
+
+#endif
+
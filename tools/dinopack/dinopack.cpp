@@ -0,0 +1,239 @@
+// dinopack - Builds an AssetPack from a Dinothawr game directory.
+//
+// Usage: dinopack <game dir> <output pack>
+//        dinopack --level <input tmx> <output lvl>
+//
+// Every PNG is decoded to Blit::Pixel, or to palette indices if it has
+// few enough colors, and every WAV to the float PCM SFXManager plays,
+// so the core can use them straight from the mapping.
+// Every TMX is compiled to the binary TilemapData format.
+
+#include "asset_pack.hpp"
+#include "tilemap_data.hpp"
+#include "blit.hpp"
+#include "palette.hpp"
+#include "rpng.h"
+#include "audio/mixer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace Blit;
+using namespace std;
+
+struct Asset
+{
+   string name;
+   AssetPack::Type type;
+   unsigned width, height;
+   vector<uint8_t> data;
+};
+
+static bool has_extension(const string& name, const char *ext)
+{
+   auto len = strlen(ext);
+   return name.size() > len && Utils::tolower(name.substr(name.size() - len)) == ext;
+}
+
+static void list_files(const string& root, const string& rel, vector<string>& files)
+{
+   auto dir = root + (rel.empty() ? "" : "/" + rel);
+   DIR *d = opendir(dir.c_str());
+   if (!d)
+      throw runtime_error(Utils::join("Failed to open directory: ", dir));
+
+   while (auto ent = readdir(d))
+   {
+      string name = ent->d_name;
+      if (name == "." || name == "..")
+         continue;
+
+      auto child = rel.empty() ? name : rel + "/" + name;
+
+      struct stat st;
+      if (stat((root + "/" + child).c_str(), &st) < 0)
+         continue;
+
+      if (S_ISDIR(st.st_mode))
+         list_files(root, child, files);
+      else
+         files.push_back(child);
+   }
+
+   closedir(d);
+}
+
+static Asset load_image(const string& root, const string& name)
+{
+   uint32_t *image = nullptr;
+   unsigned width = 0, height = 0;
+   if (!rpng_load_image_argb((root + "/" + name).c_str(), &image, &width, &height))
+      throw runtime_error(Utils::join("RPNG failed to load image: ", name));
+
+   // Same conversion as SurfaceCache::load_image.
+   vector<Pixel> pix(width * height);
+   for (unsigned i = 0; i < width * height; i++)
+   {
+      pix[i] = Pixel::ARGB(
+            uint8_t(image[i] >> 24),
+            uint8_t(image[i] >> 16),
+            uint8_t(image[i] >>  8),
+            uint8_t(image[i] >>  0));
+   }
+   free(image);
+
+   Palette palette;
+   vector<uint8_t> indices;
+   if (index_pixels(pix.data(), pix.size(), palette, indices))
+   {
+      auto bytes = reinterpret_cast<const uint8_t*>(palette.data());
+      vector<uint8_t> data(bytes, bytes + sizeof(palette));
+      data.insert(end(data), begin(indices), end(indices));
+      return { name, AssetPack::Type::IndexedImage, width, height, move(data) };
+   }
+
+   auto bytes = reinterpret_cast<const uint8_t*>(pix.data());
+   return { name, AssetPack::Type::Image, width, height, { bytes, bytes + pix.size() * sizeof(Pixel) } };
+}
+
+static Asset load_wave(const string& root, const string& name)
+{
+   auto pcm = Audio::WAVFile::load_wave(root + "/" + name);
+   auto bytes = reinterpret_cast<const uint8_t*>(pcm.data());
+   return { name, AssetPack::Type::PCM, 0, 0, { bytes, bytes + pcm.size() * sizeof(float) } };
+}
+
+static Asset load_level(const string& root, const string& name)
+{
+   auto data = TilemapData::from_tmx(root + "/" + name).to_binary();
+   return { name, AssetPack::Type::Level, 0, 0, move(data) };
+}
+
+static void write_level(const string& tmx, const string& path)
+{
+   auto data = TilemapData::from_tmx(tmx).to_binary();
+
+   FILE *file = fopen(path.c_str(), "wb");
+   if (!file)
+      throw runtime_error(Utils::join("Failed to open output: ", path));
+
+   fwrite(data.data(), 1, data.size(), file);
+
+   // A short write, like on a full disk, sets the error flag.
+   bool failed = ferror(file);
+   if (fclose(file) != 0 || failed)
+      throw runtime_error(Utils::join("Failed to write output: ", path));
+}
+
+static void write_pack(const string& path, vector<Asset>& assets)
+{
+   sort(begin(assets), end(assets), [](const Asset& a, const Asset& b) {
+            return a.name < b.name;
+         });
+
+   string strings;
+   vector<AssetPack::Entry> entries;
+   for (auto& asset : assets)
+   {
+      AssetPack::Entry entry{};
+      entry.name_offset = strings.size();
+      entry.type        = static_cast<uint32_t>(asset.type);
+      entry.width       = asset.width;
+      entry.height      = asset.height;
+      entry.size        = asset.data.size();
+      entries.push_back(entry);
+
+      strings += asset.name;
+      strings += '\0';
+   }
+
+   auto align = [](uint64_t offset) {
+      return (offset + AssetPack::alignment - 1) & ~uint64_t(AssetPack::alignment - 1);
+   };
+
+   AssetPack::Header header{};
+   memcpy(header.magic, AssetPack::magic, sizeof(header.magic));
+   header.version        = AssetPack::version;
+   header.num_entries    = entries.size();
+   header.strings_offset = sizeof(header) + entries.size() * sizeof(AssetPack::Entry);
+   header.strings_size   = strings.size();
+
+   uint64_t offset = header.strings_offset + header.strings_size;
+   for (auto& entry : entries)
+   {
+      offset = align(offset);
+      entry.offset = offset;
+      offset += entry.size;
+   }
+
+   FILE *file = fopen(path.c_str(), "wb");
+   if (!file)
+      throw runtime_error(Utils::join("Failed to open output: ", path));
+
+   fwrite(&header, sizeof(header), 1, file);
+   fwrite(entries.data(), sizeof(AssetPack::Entry), entries.size(), file);
+   fwrite(strings.data(), 1, strings.size(), file);
+
+   for (unsigned i = 0; i < entries.size(); i++)
+   {
+      static const uint8_t zero[AssetPack::alignment] = {};
+      fwrite(zero, 1, entries[i].offset - ftell(file), file);
+      fwrite(assets[i].data.data(), 1, assets[i].data.size(), file);
+   }
+
+   bool failed = ferror(file);
+   if (fclose(file) != 0 || failed)
+      throw runtime_error(Utils::join("Failed to write output: ", path));
+}
+
+int main(int argc, char *argv[])
+{
+   bool level = argc == 4 && !strcmp(argv[1], "--level");
+   if (argc != 3 && !level)
+   {
+      cerr << "Usage: " << argv[0] << " <game dir> <output pack>" << endl;
+      cerr << "       " << argv[0] << " --level <input tmx> <output lvl>" << endl;
+      return EXIT_FAILURE;
+   }
+
+   try
+   {
+      if (level)
+      {
+         write_level(argv[2], argv[3]);
+         return EXIT_SUCCESS;
+      }
+
+      string root = argv[1];
+      vector<string> files;
+      list_files(root, "", files);
+
+      vector<Asset> assets;
+      for (auto& name : files)
+      {
+         if (has_extension(name, ".png"))
+            assets.push_back(load_image(root, name));
+         else if (has_extension(name, ".wav"))
+            assets.push_back(load_wave(root, name));
+         else if (has_extension(name, ".tmx"))
+            assets.push_back(load_level(root, name));
+      }
+
+      write_pack(argv[2], assets);
+      cerr << "Packed " << assets.size() << " assets into " << argv[2] << "." << endl;
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+   }
+}
+
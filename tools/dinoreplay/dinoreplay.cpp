@@ -0,0 +1,316 @@
+// dinoreplay - Plays back replays of a Dinothawr game as fast as the CPU allows.
+//
+// Usage: dinoreplay <game file> <replay>
+//        dinoreplay --record-solutions <game file> <replay>
+//
+// The game runs headless, see GameManager, so nothing is rendered or heard.
+// Playback checks the checksums of the replay, and prints how long loading
+// and playing took. Exits with failure if the game diverged from the recording.
+//
+// --record-solutions plays every level from a fresh save, in the order the
+// game moves on to them, with a solution of the fewest pushes from Solver,
+// and records that. Exits with failure if a solution does not play out in
+// the game, or a level is won with more pushes than the solver found.
+
+#include "replay.hpp"
+#include "asset_pack.hpp"
+#include "atlas.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Blit;
+using namespace Icy;
+using namespace std;
+
+static Audio::Mixer mixer;
+static SFXManager sfx;
+static BGManager bg_music;
+static AssetPack asset_pack;
+static Atlas atlas;
+static string game_path_dir;
+
+namespace Icy
+{
+   Audio::Mixer& get_mixer() { return mixer; }
+   const string& get_basedir() { return game_path_dir; }
+   SFXManager& get_sfx() { return sfx; }
+   BGManager& get_bg() { return bg_music; }
+}
+
+namespace Blit
+{
+   AssetPack& get_asset_pack() { return asset_pack; }
+   Atlas& get_atlas() { return atlas; }
+}
+
+// There is no frontend to log to.
+retro_log_printf_t log_cb;
+
+// Bit n is set while Input n is held, as in replays.
+static uint16_t input_mask;
+
+static uint16_t input_bit(Input input)
+{
+   return 1 << static_cast<unsigned>(input);
+}
+
+static void open_asset_pack(const string& path)
+{
+   auto ext = path.find_last_of('.');
+   auto sep = path.find_last_of("/\\");
+   if (ext == string::npos || (sep != string::npos && ext < sep))
+      ext = path.size();
+
+   asset_pack.open(Utils::join(path.substr(0, ext), ".pack"), Utils::basedir(path));
+}
+
+static unique_ptr<GameManager> load_game(const string& path)
+{
+   game_path_dir = Utils::basedir(path);
+   open_asset_pack(path);
+
+   return Utils::make_unique<GameManager>(path, [](Input input) {
+            return bool(input_mask & input_bit(input));
+         }, nullptr, true);
+}
+
+static double ms_since(chrono::steady_clock::time_point start)
+{
+   return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Plays the solutions of Solver level after level, by giving the input
+// Game takes for each step, one frame at a time.
+class SolutionDriver
+{
+   public:
+      // Input for the next frame of manager.
+      uint16_t input(const GameManager& manager);
+
+      // Fewest pushes of every level started so far, in order.
+      const vector<unsigned>& optimum() const { return m_optimum; }
+
+   private:
+      unsigned chapter = ~0u, level = ~0u;
+      vector<Solver::Push> pushes;
+      unsigned next = 0;
+      bool facing = false;
+      vector<unsigned> m_optimum;
+
+      void solve(const Game& game);
+      string name() const { return Utils::join(chapter + 1, "-", level + 1); }
+};
+
+// Directions are indexed as Input::Up through Input::Right.
+static const Pos dirs[4] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+
+// First direction of a shortest walk of the player to tile, or -1 if it
+// cannot get there. As in Game, the player steps onto a free tile, then
+// slides on while the tile is slippery for the player and the next one is free.
+static int first_step(const Puzzle& puzzle, Pos tile)
+{
+   vector<bool> blocked(puzzle.flags.size());
+   for (unsigned i = 0; i < blocked.size(); i++)
+      blocked[i] = puzzle.flags[i] & Puzzle::Wall;
+   for (auto& block : puzzle.goal_blocks)
+      blocked[block.y * puzzle.width + block.x] = true;
+   for (auto& block : puzzle.other_blocks)
+      blocked[block.y * puzzle.width + block.x] = true;
+
+   auto is_free = [&](Pos pos) {
+      return pos.x >= 0 && pos.y >= 0 && pos.x < puzzle.width && pos.y < puzzle.height &&
+         !blocked[pos.y * puzzle.width + pos.x];
+   };
+
+   // First direction taken to get to each tile, or -1 if not reached yet.
+   vector<int> first(puzzle.flags.size(), -1);
+   deque<Pos> queue{puzzle.player};
+   first[puzzle.player.y * puzzle.width + puzzle.player.x] = 0;
+
+   while (!queue.empty())
+   {
+      auto from = queue.front();
+      queue.pop_front();
+      if (from == tile)
+         return first[tile.y * puzzle.width + tile.x];
+
+      for (int d = 0; d < 4; d++)
+      {
+         auto dest = from + dirs[d];
+         if (!is_free(dest))
+            continue;
+
+         while ((puzzle.flags[dest.y * puzzle.width + dest.x] & Puzzle::SlipperyPlayer) && is_free(dest + dirs[d]))
+            dest += dirs[d];
+
+         auto& dest_first = first[dest.y * puzzle.width + dest.x];
+         if (dest_first < 0)
+         {
+            dest_first = from == puzzle.player ? d : first[from.y * puzzle.width + from.x];
+            queue.push_back(dest);
+         }
+      }
+   }
+
+   return -1;
+}
+
+void SolutionDriver::solve(const Game& game)
+{
+   chapter = game.get_chapter();
+   level   = game.get_level();
+   next    = 0;
+   facing  = false;
+
+   auto result = Solver(game.puzzle()).solve();
+   if (!result.solved)
+      throw runtime_error(Utils::join("Level ", name(), " has no solution."));
+
+   pushes = move(result.pushes);
+   m_optimum.push_back(pushes.size());
+}
+
+// Input is only given while the game is idle, so it is read on the frame it
+// is given. Before each push, the player turns to the block, which also
+// releases Push so the push is a new press.
+uint16_t SolutionDriver::input(const GameManager& manager)
+{
+   auto game = manager.current_game();
+   if (manager.game_state() != GameManager::State::Game || !game)
+      throw runtime_error("Game left the level being played.");
+
+   if (!game->idle())
+      return 0;
+
+   if (game->get_chapter() != chapter || game->get_level() != level)
+      solve(*game);
+
+   if (next >= pushes.size())
+      throw runtime_error(Utils::join("Level ", name(), " is not won after its solution."));
+
+   auto& push = pushes[next];
+   auto puzzle = game->puzzle();
+   unsigned dir = find(begin(dirs), end(dirs), push.dir) - begin(dirs);
+
+   if (puzzle.player == push.player)
+   {
+      if (!facing)
+      {
+         facing = true;
+         return input_bit(static_cast<Input>(dir));
+      }
+
+      facing = false;
+      next++;
+      return input_bit(Input::Push);
+   }
+
+   facing = false;
+   int step = first_step(puzzle, push.player);
+   if (step < 0)
+      throw runtime_error(Utils::join("Level ", name(), ": push ", next + 1, " cannot be walked to."));
+
+   return input_bit(static_cast<Input>(step));
+}
+
+static bool record_solutions(const string& game_path, const string& replay_path)
+{
+   auto manager = load_game(game_path);
+   manager->start_level(0, 0);
+
+   Replay replay(*manager);
+   SolutionDriver driver;
+
+   auto start = chrono::steady_clock::now();
+   while (manager->game_state() != GameManager::State::End)
+   {
+      input_mask = driver.input(*manager);
+      manager->iterate(false);
+      replay.record(input_mask, *manager);
+   }
+
+   replay.save(replay_path);
+   printf("Recorded %u levels in %u frames, %.1f ms\n",
+         unsigned(driver.optimum().size()), replay.frames(), ms_since(start));
+
+   // Levels are won in the order they were played, as none were solved before.
+   auto progress = manager->progress();
+   bool ok = progress.size() == driver.optimum().size();
+   for (unsigned i = 0; ok && i < progress.size(); i++)
+   {
+      if (progress[i] != driver.optimum()[i])
+      {
+         printf("Level %u was won with %u pushes, but %u is the fewest\n", i + 1, progress[i], driver.optimum()[i]);
+         ok = false;
+      }
+   }
+
+   return ok;
+}
+
+static bool play(const string& game_path, const string& replay_path)
+{
+   auto start = chrono::steady_clock::now();
+   auto manager = load_game(game_path);
+   auto replay = Replay::load(replay_path);
+   replay.start(*manager);
+   printf("Loaded in %.1f ms\n", ms_since(start));
+
+   auto before = manager->progress();
+
+   start = chrono::steady_clock::now();
+   unsigned frame = 0;
+   bool diverged = false;
+   for (; frame < replay.frames() && !diverged; frame++)
+   {
+      input_mask = replay.input(frame);
+      manager->iterate(false);
+      diverged = !replay.verify(frame, *manager);
+   }
+
+   double ms = ms_since(start);
+   printf("Played %u frames in %.1f ms, %.0f frames per second\n", frame, ms, frame / (ms / 1000.0));
+
+   auto after = manager->progress();
+   unsigned won = 0;
+   for (unsigned i = 0; i < after.size(); i++)
+      won += after[i] && !before[i];
+   printf("Won %u levels which were unsolved\n", won);
+
+   if (diverged)
+      printf("Diverged by frame %u\n", frame - 1);
+   return !diverged;
+}
+
+int main(int argc, char *argv[])
+{
+   bool record = argc == 4 && !strcmp(argv[1], "--record-solutions");
+   if (argc != 3 && !record)
+   {
+      cerr << "Usage: " << argv[0] << " <game file> <replay>" << endl;
+      cerr << "       " << argv[0] << " --record-solutions <game file> <replay>" << endl;
+      return EXIT_FAILURE;
+   }
+
+   try
+   {
+      bool ok = record ? record_solutions(argv[2], argv[3]) : play(argv[1], argv[2]);
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+   }
+}
@@ -0,0 +1,177 @@
+// dinosolve - Finds the fewest pushes for every level of a Dinothawr game.
+//
+// Usage: dinosolve <game file> [save file]
+//        dinosolve --level <tmx>
+//
+// Prints the fewest pushes per level and how long the solve took.
+// Given a save file, the best pushes recorded in it are checked against
+// them, as no player can beat the optimum. Exits with failure if a level
+// has no solution or a recorded best is below the optimum.
+
+#include "solver.hpp"
+#include "asset_pack.hpp"
+#include "atlas.hpp"
+#include "xml_document.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Blit;
+using namespace Icy;
+using namespace std;
+
+static AssetPack asset_pack;
+static Atlas atlas;
+
+namespace Blit
+{
+   AssetPack& get_asset_pack() { return asset_pack; }
+   Atlas& get_atlas() { return atlas; }
+}
+
+struct LevelResult
+{
+   bool solved;
+   unsigned pushes;
+};
+
+static LevelResult solve_level(const string& path, const string& name)
+{
+   Tilemap map(path);
+   EntityStore entities(map, "blocks");
+   SlideMap slides(map, entities);
+
+   auto layer = map.find_layer("floor");
+   if (!layer)
+      throw runtime_error(Utils::join("Floor layer not found: ", path));
+
+   int x = Utils::stoi(Utils::find_or_default(layer->attr, "start_x", "1"));
+   int y = Utils::stoi(Utils::find_or_default(layer->attr, "start_y", "1"));
+
+   auto start = chrono::steady_clock::now();
+   auto result = Solver(Puzzle(slides, entities, {x, y})).solve();
+   auto ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+   if (result.solved)
+      printf("%-6s %4u pushes %10u states %9.1f ms\n", name.c_str(),
+            unsigned(result.pushes.size()), unsigned(result.states), ms);
+   else
+      printf("%-6s %s %10u states %9.1f ms\n", name.c_str(),
+            result.exhausted ? "gave up    " : "unsolvable ", unsigned(result.states), ms);
+
+   return {result.solved, unsigned(result.pushes.size())};
+}
+
+// Best pushes per level, one line of comma separated values per chapter,
+// as GameManager saves them.
+static vector<vector<unsigned>> read_save(const string& path)
+{
+   ifstream file(path, ios::binary);
+   if (!file)
+      throw runtime_error(Utils::join("Failed to open save file: ", path));
+
+   vector<vector<unsigned>> chapters;
+   string line;
+   while (getline(file, line))
+   {
+      line = line.substr(0, line.find('\0'));
+      vector<unsigned> levels;
+      for (auto& level : Utils::split(line, ','))
+         levels.push_back(Utils::stoi(level));
+      chapters.push_back(move(levels));
+   }
+   return chapters;
+}
+
+static unsigned recorded_best(const vector<vector<unsigned>>& save, unsigned chapter, unsigned level)
+{
+   if (chapter >= save.size() || level >= save[chapter].size())
+      return 0;
+   return save[chapter][level];
+}
+
+static void open_asset_pack(const string& path)
+{
+   auto ext = path.find_last_of('.');
+   auto sep = path.find_last_of("/\\");
+   if (ext == string::npos || (sep != string::npos && ext < sep))
+      ext = path.size();
+
+   asset_pack.open(Utils::join(path.substr(0, ext), ".pack"), Utils::basedir(path));
+}
+
+int main(int argc, char *argv[])
+{
+   bool level = argc == 3 && !strcmp(argv[1], "--level");
+   if (argc != 2 && argc != 3)
+   {
+      cerr << "Usage: " << argv[0] << " <game file> [save file]" << endl;
+      cerr << "       " << argv[0] << " --level <tmx>" << endl;
+      return EXIT_FAILURE;
+   }
+
+   try
+   {
+      if (level)
+         return solve_level(argv[2], "level").solved ? EXIT_SUCCESS : EXIT_FAILURE;
+
+      string path = argv[1];
+      open_asset_pack(path);
+
+      vector<vector<unsigned>> save;
+      if (argc == 3)
+         save = read_save(argv[2]);
+
+      XMLDocument doc;
+      if (!doc.load(path))
+         throw runtime_error(Utils::join("Failed to load game: ", path, "."));
+
+      auto dir = Utils::basedir(path);
+      bool ok = true;
+      unsigned chapter = 0;
+
+      auto start = chrono::steady_clock::now();
+      for (auto node = doc.child("game").child("chapter"); node; node = node.next_sibling("chapter"))
+      {
+         unsigned level = 0;
+         for (auto source : Utils::xml_node_walker{node, "map", "source"})
+         {
+            auto name = Utils::join(chapter + 1, "-", level + 1);
+            auto result = solve_level(Utils::join(dir, "/", source), name);
+            ok &= result.solved;
+
+            unsigned best = recorded_best(save, chapter, level);
+            if (result.solved && best && best < result.pushes)
+            {
+               printf("%-6s recorded best of %u pushes is below the optimum\n", name.c_str(), best);
+               ok = false;
+            }
+
+            level++;
+         }
+
+         if (level)
+            chapter++;
+      }
+
+      auto ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      printf("Total %.1f ms\n", ms);
+
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+   }
+}
+
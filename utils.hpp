@@ -2,6 +2,7 @@
 #define UTILS_HPP__
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 
 #include <string>
@@ -14,6 +15,8 @@
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <functional>
+#include <type_traits>
 #include <errno.h>
 
 
@@ -37,20 +40,141 @@ namespace Blit
          return (ptr[0] << 0) + (ptr[1] << 8);
       }
 
+      // Stand-in for std::to_chars, which we cannot rely on.
+      // Writes value in base 10 to [first, last). Returns the end of the
+      // written characters, or nullptr if they do not fit.
       template <typename T>
-      inline std::string join(T&& t)
+      inline typename std::enable_if<std::is_integral<T>::value, char*>::type
+      to_chars(char* first, char* last, T value)
       {
-         std::ostringstream stream;
-         stream << std::forward<T>(t);
-         return stream.str();
+         typedef typename std::make_unsigned<T>::type U;
+         U mag = value < 0 ? U(0) - U(value) : U(value);
+
+         char buf[std::numeric_limits<U>::digits10 + 2];
+         char *ptr = buf + sizeof(buf);
+         do
+         {
+            *--ptr = '0' + mag % 10;
+            mag /= 10;
+         } while (mag);
+
+         if (value < 0)
+            *--ptr = '-';
+
+         std::size_t len = buf + sizeof(buf) - ptr;
+         if (len > std::size_t(last - first))
+            return nullptr;
+
+         return std::copy(ptr, buf + sizeof(buf), first);
+      }
+
+      // Appenders shared by join, and FixedString.
+      // Sink needs append(const char*, std::size_t).
+      template <typename Sink, typename T>
+      inline typename std::enable_if<std::is_integral<T>::value>::type
+      append(Sink& sink, T value)
+      {
+         char buf[std::numeric_limits<T>::digits10 + 3];
+         sink.append(buf, to_chars(buf, buf + sizeof(buf), value) - buf);
       }
 
-      template <typename T, typename... U>
-      inline std::string join(T&& t, U&&... u)
+      template <typename Sink>
+      inline void append(Sink& sink, bool value) { sink.append(value ? "1" : "0", 1); }
+      template <typename Sink>
+      inline void append(Sink& sink, char c) { sink.append(&c, 1); }
+      template <typename Sink>
+      inline void append(Sink& sink, const char* str) { sink.append(str, std::strlen(str)); }
+      template <typename Sink>
+      inline void append(Sink& sink, const std::string& str) { sink.append(str.data(), str.size()); }
+
+      // Anything else, e.g. floats, goes through a stream.
+      template <typename Sink, typename T>
+      inline typename std::enable_if<!std::is_integral<T>::value &&
+         !std::is_convertible<const T&, const char*>::value &&
+         !std::is_convertible<const T&, const std::string&>::value>::type
+      append(Sink& sink, const T& value)
       {
          std::ostringstream stream;
-         stream << std::forward<T>(t) << join(std::forward<U>(u)...);
-         return stream.str();
+         stream << value;
+         append(sink, stream.str());
+      }
+
+      template <typename Sink>
+      inline void append_all(Sink&) {}
+
+      template <typename Sink, typename T, typename... U>
+      inline void append_all(Sink& sink, T&& t, U&&... u)
+      {
+         append(sink, std::forward<T>(t));
+         append_all(sink, std::forward<U>(u)...);
+      }
+
+      template <typename... T>
+      inline std::string join(T&&... t)
+      {
+         std::string str;
+         append_all(str, std::forward<T>(t)...);
+         return str;
+      }
+
+      // A string in a fixed buffer, for formatting on hot paths without
+      // touching the heap. Anything past the capacity is cut off.
+      template <std::size_t N>
+      class FixedString
+      {
+         public:
+            FixedString() : len(0) { buf[0] = '\0'; }
+
+            void append(const char* str, std::size_t size)
+            {
+               size = std::min(size, N - 1 - len);
+               std::copy(str, str + size, buf + len);
+               len += size;
+               buf[len] = '\0';
+            }
+
+            void clear() { len = 0; buf[0] = '\0'; }
+
+            const char* c_str() const { return buf; }
+            std::size_t size() const { return len; }
+
+         private:
+            char buf[N];
+            std::size_t len;
+      };
+
+      // Like join, but into a FixedString of N bytes, terminator included.
+      template <std::size_t N, typename... T>
+      inline FixedString<N> format(T&&... t)
+      {
+         FixedString<N> str;
+         append_all(str, std::forward<T>(t)...);
+         return str;
+      }
+
+      // Like join, but into a caller-provided buffer. The output is cut off
+      // at size - 1 and always terminated. Returns the length written.
+      template <typename... T>
+      inline std::size_t format_to(char* buf, std::size_t size, T&&... t)
+      {
+         struct Sink
+         {
+            char* buf;
+            std::size_t size, len;
+            void append(const char* str, std::size_t n)
+            {
+               n = std::min(n, size - 1 - len);
+               std::copy(str, str + n, buf + len);
+               len += n;
+            }
+         } sink{buf, size, 0};
+
+         if (!size)
+            return 0;
+
+         append_all(sink, std::forward<T>(t)...);
+         buf[sink.len] = '\0';
+         return sink.len;
       }
 
       inline std::vector<std::string> split(const std::string& str, char delim)
@@ -116,10 +240,12 @@ namespace Blit
          return itr->second;
       }
 
+      // Walks one attribute across all same-named children of a node.
+      // Values point into the document, nothing is copied.
       class xml_node_walker
       {
          public:
-            xml_node_walker(pugi::xml_node parent, const std::string& child, const std::string& attr)
+            xml_node_walker(pugi::xml_node parent, const char* child, const char* attr)
                : parent(parent), child(child), attr(attr)
             {}
 
@@ -127,17 +253,15 @@ namespace Blit
             {
                public:
                   iterator(pugi::xml_node parent, const char* child, const char* attr) :
-                     child_name(child), attr(attr), node(parent.child(child)), val(node.attribute(attr).value()) {}
+                     child_name(child), attr(attr), node(parent.child(child)) {}
 
                   iterator() : child_name(nullptr), attr(nullptr) {}
 
-                  const std::string& operator*() const { return val; }
-                  const std::string* operator->() const { return &val; }
+                  const char* operator*() const { return node.attribute(attr).value(); }
 
                   iterator& operator++()
                   {
                      node = node.next_sibling(child_name);
-                     val  = node.attribute(attr).value();
                      return *this;
                   }
 
@@ -148,16 +272,15 @@ namespace Blit
                   const char* child_name;
                   const char* attr;
                   pugi::xml_node node;
-                  std::string val;
             };
 
-            iterator begin() { return iterator(parent, child.c_str(), attr.c_str()); }
+            iterator begin() { return iterator(parent, child, attr); }
             iterator end() { return iterator(); }
 
          private:
             pugi::xml_node parent;
-            std::string child;
-            std::string attr;
+            const char* child;
+            const char* attr;
       };
 
       template <typename T, typename... Args>
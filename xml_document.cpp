@@ -0,0 +1,16 @@
+#include "xml_document.hpp"
+
+namespace Blit
+{
+   bool XMLDocument::load(const std::string& path)
+   {
+      reset();
+
+      file = MappedFile::open(path, true);
+      if (!file)
+         return false;
+
+      return load_buffer_inplace(file->mutable_data(), file->size());
+   }
+}
+
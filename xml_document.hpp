@@ -0,0 +1,26 @@
+#ifndef XML_DOCUMENT_HPP__
+#define XML_DOCUMENT_HPP__
+
+#include "mapped_file.hpp"
+#include "pugixml/pugixml.hpp"
+
+#include <memory>
+#include <string>
+
+namespace Blit
+{
+   // Parses an XML file in-situ from a private mapping of it.
+   // Node names and values point straight into the mapping, so they are
+   // only valid while the document lives. Copy out what needs to persist.
+   class XMLDocument : public pugi::xml_document
+   {
+      public:
+         bool load(const std::string& path);
+
+      private:
+         std::shared_ptr<MappedFile> file;
+   };
+}
+
+#endif
+